@@ -0,0 +1,76 @@
+#include "CursorCache.hpp"
+
+#include "CgStr.hpp"
+#include "MultiTuProcessor.hpp"
+#include "highlight.hpp"
+#include "xref.hpp"
+
+using namespace synth;
+
+std::pair<CursorCache::Entry*, bool> CursorCache::lookup(
+    CXCursor cur, unsigned flag)
+{
+    ++m_lookups;
+    Entry& e = m_entries[cur];
+    if (e.present & flag) {
+        ++m_hits;
+        return {&e, true};
+    }
+    e.present |= flag;
+    return {&e, false};
+}
+
+CXCursor CursorCache::definition(CXCursor cur)
+{
+    auto r = lookup(cur, Entry::hasDefinition);
+    if (!r.second)
+        r.first->definition = clang_getCursorDefinition(cur);
+    return r.first->definition;
+}
+
+CXCursor CursorCache::effectiveReferenced(CXCursor cur)
+{
+    CXCursor refd = clang_getCursorReferenced(cur);
+    auto r = lookup(refd, Entry::hasEffectiveDecl);
+    if (!r.second)
+        r.first->effectiveDecl = effectiveDeclaration(refd);
+    return r.first->effectiveDecl;
+}
+
+CXCursor CursorCache::specializedTemplate(CXCursor cur)
+{
+    auto r = lookup(cur, Entry::hasSpecialized);
+    if (!r.second)
+        r.first->specialized = clang_getSpecializedCursorTemplate(cur);
+    return r.first->specialized;
+}
+
+std::string const& CursorCache::usr(CXCursor cur)
+{
+    auto r = lookup(cur, Entry::hasUsr);
+    if (!r.second)
+        r.first->usr = CgStr(clang_getCursorUSR(cur)).copy();
+    return r.first->usr;
+}
+
+SymbolDeclaration const* CursorCache::declSymbol(
+    CXCursor decl, MultiTuProcessor& state)
+{
+    auto r = lookup(decl, Entry::hasSymbol);
+    if (!r.second) {
+        CXFile file;
+        unsigned lineno, offset;
+        clang_getFileLocation(
+            clang_getCursorLocation(decl), &file, &lineno, nullptr, &offset);
+        r.first->symbol = state.referenceSymbol(file, lineno, offset);
+    }
+    return r.first->symbol;
+}
+
+TokenAttributes CursorCache::varTokenAttributes(CXCursor varDecl)
+{
+    auto r = lookup(varDecl, Entry::hasVarAttrs);
+    if (!r.second)
+        r.first->varAttrs = getVarTokenAttributes(varDecl);
+    return r.first->varAttrs;
+}
@@ -0,0 +1,87 @@
+#ifndef SYNTH_CURSORCACHE_HPP_INCLUDED
+#define SYNTH_CURSORCACHE_HPP_INCLUDED
+
+#include "output.hpp" // TokenAttributes
+
+#include <clang-c/Index.h>
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace synth {
+
+class MultiTuProcessor;
+
+// Memoizes properties derived from cursors. Lookups that depend only on the
+// referenced entity are keyed by the referenced cursor, so that e.g. all uses
+// of a variable share one entry. Not threadsafe; use one instance per
+// translation unit.
+class CursorCache {
+public:
+    CXCursor definition(CXCursor cur);
+
+    // Like effectiveDeclaration(clang_getCursorReferenced(cur)).
+    CXCursor effectiveReferenced(CXCursor cur);
+
+    CXCursor specializedTemplate(CXCursor cur);
+    std::string const& usr(CXCursor cur);
+
+    // Returns the result of MultiTuProcessor::referenceSymbol() for the
+    // location of decl.
+    SymbolDeclaration const* declSymbol(
+        CXCursor decl, MultiTuProcessor& state);
+
+    // Cached getVarTokenAttributes().
+    TokenAttributes varTokenAttributes(CXCursor varDecl);
+
+    std::size_t lookups() const noexcept { return m_lookups; }
+    std::size_t hits() const noexcept { return m_hits; }
+
+private:
+    struct Entry {
+        enum : unsigned {
+            hasDefinition = 1 << 0,
+            hasEffectiveDecl = 1 << 1,
+            hasSpecialized = 1 << 2,
+            hasUsr = 1 << 3,
+            hasSymbol = 1 << 4,
+            hasVarAttrs = 1 << 5
+        };
+
+        unsigned present = 0;
+        CXCursor definition;
+        CXCursor effectiveDecl; // Of the cursor as referenced cursor.
+        CXCursor specialized;
+        std::string usr;
+        SymbolDeclaration const* symbol;
+        TokenAttributes varAttrs;
+    };
+
+    struct CursorHasher {
+        std::size_t operator() (CXCursor const& c) const
+        {
+            return clang_hashCursor(c);
+        }
+    };
+
+    struct CursorEq {
+        bool operator() (CXCursor const& lhs, CXCursor const& rhs) const
+        {
+            return clang_equalCursors(lhs, rhs) != 0;
+        }
+    };
+
+    // Returns the entry for cur and whether flag was already present in it.
+    // Updates the counters accordingly.
+    std::pair<Entry*, bool> lookup(CXCursor cur, unsigned flag);
+
+    std::unordered_map<CXCursor, Entry, CursorHasher, CursorEq> m_entries;
+    std::size_t m_lookups = 0;
+    std::size_t m_hits = 0;
+};
+
+} // namespace synth
+
+#endif // SYNTH_CURSORCACHE_HPP_INCLUDED
@@ -3,6 +3,7 @@
 #include "CgStr.hpp"
 #include "output.hpp"
 #include "debug.hpp"
+#include "memstats.hpp"
 #include "xref.hpp"
 
 #include <boost/property_tree/ptree.hpp>
@@ -74,6 +75,17 @@ void DoxytagResolver::link(Markup & m, CXCursor cur)
     };
 }
 
+void DoxytagResolver::addMemoryStats(MemoryStats& stats) const
+{
+    stats.doxytags.count += m_dsts.size();
+    stats.doxytags.bytes += unorderedMapBytes(m_dsts)
+        + stringHeapBytes(m_baseUrl);
+    for (auto const& dst : m_dsts) {
+        stats.doxytags.bytes += stringHeapBytes(dst.first)
+            + stringHeapBytes(dst.second);
+    }
+}
+
 void synth::DoxytagResolver::parseCompound(
     ptree::ptree const& compound, std::string const& prefix)
 {
@@ -11,6 +11,7 @@
 namespace synth {
 
 struct Markup;
+struct MemoryStats;
 
 namespace ptree = boost::property_tree;
 namespace fs = boost::filesystem;
@@ -24,6 +25,8 @@ public:
 
     void link(Markup& m, CXCursor cur);
 
+    void addMemoryStats(MemoryStats& stats) const;
+
 private:
     void parseCompound(ptree::ptree const& compound, std::string const& prefix);
     std::string const* addTag(ptree::ptree const& tag, std::string const& prefix);
@@ -0,0 +1,134 @@
+#include "FileWatcher.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#   include <poll.h>
+#   include <sys/inotify.h>
+#   include <unistd.h>
+#endif
+
+using namespace synth;
+
+#ifndef __linux__
+
+FileWatcher::FileWatcher(std::vector<fs::path> const&)
+    : m_fd(-1)
+{
+    throw std::runtime_error("--watch is not supported on this platform.");
+}
+
+FileWatcher::~FileWatcher() = default;
+
+std::unordered_set<std::string> FileWatcher::waitForChanges(
+    std::chrono::milliseconds)
+{
+    return {};
+}
+
+void FileWatcher::watchTree(fs::path const&) { }
+
+#else
+
+static std::uint32_t const kWatchedEvents = IN_CLOSE_WRITE | IN_CREATE
+    | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+static std::runtime_error errnoError(char const* what)
+{
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+FileWatcher::FileWatcher(std::vector<fs::path> const& dirs)
+    : m_fd(inotify_init1(IN_CLOEXEC))
+{
+    if (m_fd == -1)
+        throw errnoError("inotify_init1");
+    try {
+        for (fs::path const& dir : dirs)
+            watchTree(fs::absolute(dir).lexically_normal());
+    } catch (...) {
+        close(m_fd);
+        throw;
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    close(m_fd);
+}
+
+void FileWatcher::watchTree(fs::path const& dir)
+{
+    int wd = inotify_add_watch(m_fd, dir.c_str(), kWatchedEvents | IN_ONLYDIR);
+    if (wd == -1) {
+        // E.g. a directory that was removed again immediately.
+        std::clog << "Cannot watch " << dir << ": " << std::strerror(errno)
+                  << '\n';
+        return;
+    }
+    m_dirs[wd] = dir;
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; it != end; it.increment(ec)) {
+        if (ec)
+            break;
+        if (fs::is_directory(it->symlink_status()))
+            watchTree(it->path());
+    }
+}
+
+std::unordered_set<std::string> FileWatcher::waitForChanges(
+    std::chrono::milliseconds quietPeriod)
+{
+    std::unordered_set<std::string> changed;
+    alignas(inotify_event) char buf[16 * 1024];
+    for (;;) {
+        pollfd pfd {m_fd, POLLIN, 0};
+        int nReady = poll(
+            &pfd, 1, changed.empty() ? -1 : int(quietPeriod.count()));
+        if (nReady == -1) {
+            if (errno == EINTR)
+                continue;
+            throw errnoError("poll");
+        }
+        if (nReady == 0)
+            return changed;
+
+        ssize_t sz = read(m_fd, buf, sizeof(buf));
+        if (sz == -1) {
+            if (errno == EINTR)
+                continue;
+            throw errnoError("read");
+        }
+        for (char const* p = buf; p < buf + sz;) {
+            auto const& ev = *reinterpret_cast<inotify_event const*>(p);
+            p += sizeof(inotify_event) + ev.len;
+            if (ev.mask & IN_Q_OVERFLOW) {
+                std::clog << "Warning: Too many file changes at once,"
+                             " some were missed.\n";
+                continue;
+            }
+            if (ev.mask & IN_IGNORED) {
+                m_dirs.erase(ev.wd);
+                continue;
+            }
+            auto it = m_dirs.find(ev.wd);
+            if (it == m_dirs.end() || ev.len == 0)
+                continue;
+            fs::path path = it->second / ev.name;
+            if (ev.mask & IN_ISDIR) {
+                if (ev.mask & (IN_CREATE | IN_MOVED_TO))
+                    watchTree(path);
+                continue;
+            }
+            changed.insert(path.string());
+        }
+    }
+}
+
+#endif // __linux__
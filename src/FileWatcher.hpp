@@ -0,0 +1,42 @@
+#ifndef SYNTH_FILEWATCHER_HPP_INCLUDED
+#define SYNTH_FILEWATCHER_HPP_INCLUDED
+
+#include <boost/filesystem/path.hpp>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace synth {
+
+namespace fs = boost::filesystem;
+
+// Watches directory trees for modified, created, moved and deleted files.
+// Uses inotify, so it is only supported on Linux; the constructor throws
+// std::runtime_error elsewhere.
+class FileWatcher {
+public:
+    explicit FileWatcher(std::vector<fs::path> const& dirs);
+    ~FileWatcher();
+
+    FileWatcher(FileWatcher const&) = delete;
+    FileWatcher& operator= (FileWatcher const&) = delete;
+
+    // Blocks until files changed and no further changes happened for
+    // quietPeriod, e.g. while an editor or "git checkout" is still writing.
+    // Returns the absolute, normalized paths of the changed files.
+    std::unordered_set<std::string> waitForChanges(
+        std::chrono::milliseconds quietPeriod);
+
+private:
+    void watchTree(fs::path const& dir);
+
+    int m_fd;
+    std::unordered_map<int, fs::path> m_dirs; // By watch descriptor.
+};
+
+} // namespace synth
+
+#endif // SYNTH_FILEWATCHER_HPP_INCLUDED
@@ -0,0 +1,63 @@
+#include "IncludeGraph.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+using namespace synth;
+
+std::string IncludeGraph::normalize(fs::path const& p)
+{
+    return fs::absolute(p).lexically_normal().string();
+}
+
+void IncludeGraph::addInclusion(fs::path const& file, fs::path const& includer)
+{
+    std::string fileStr = normalize(file);
+    std::string includerStr = normalize(includer);
+    std::lock_guard<std::mutex> lock(m_mut);
+    m_includes[includerStr].insert(fileStr);
+    m_includers[std::move(fileStr)].insert(std::move(includerStr));
+}
+
+IncludeGraph::FileSet IncludeGraph::includersOf(FileSet const& files) const
+{
+    std::lock_guard<std::mutex> lock(m_mut);
+    return closure(files, m_includers);
+}
+
+IncludeGraph::FileSet IncludeGraph::includedBy(FileSet const& files) const
+{
+    std::lock_guard<std::mutex> lock(m_mut);
+    return closure(files, m_includes);
+}
+
+std::vector<std::pair<std::string, std::string>>
+IncludeGraph::inclusions() const
+{
+    std::vector<std::pair<std::string, std::string>> r;
+    std::lock_guard<std::mutex> lock(m_mut);
+    for (auto const& file : m_includers) {
+        for (std::string const& includer : file.second)
+            r.emplace_back(file.first, includer);
+    }
+    return r;
+}
+
+IncludeGraph::FileSet IncludeGraph::closure(
+    FileSet const& files, Edges const& edges)
+{
+    FileSet r = files;
+    std::vector<std::string const*> todo;
+    for (std::string const& f : files)
+        todo.push_back(&f);
+    while (!todo.empty()) {
+        auto it = edges.find(*todo.back());
+        todo.pop_back();
+        if (it == edges.end())
+            continue;
+        for (std::string const& next : it->second) {
+            if (r.insert(next).second)
+                todo.push_back(&next);
+        }
+    }
+    return r;
+}
@@ -0,0 +1,51 @@
+#ifndef SYNTH_INCLUDEGRAPH_HPP_INCLUDED
+#define SYNTH_INCLUDEGRAPH_HPP_INCLUDED
+
+#include <boost/filesystem/path.hpp>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace synth {
+
+namespace fs = boost::filesystem;
+
+// Which file includes which, as seen by processTu() in all translation units,
+// for finding the translation units (and files) affected by changed files.
+// Files are identified by their normalized absolute paths (see normalize()).
+// All member functions are threadsafe.
+class IncludeGraph {
+public:
+    using FileSet = std::unordered_set<std::string>;
+
+    // Relative paths are interpreted relative to the current directory.
+    static std::string normalize(fs::path const& p);
+
+    void addInclusion(fs::path const& file, fs::path const& includer);
+
+    // Returns files and all files that directly or indirectly include one
+    // of them.
+    FileSet includersOf(FileSet const& files) const;
+
+    // Returns files and all files that they directly or indirectly include.
+    FileSet includedBy(FileSet const& files) const;
+
+    // Returns all (file, includer) pairs, e.g. to save them.
+    std::vector<std::pair<std::string, std::string>> inclusions() const;
+
+private:
+    using Edges = std::unordered_map<std::string, FileSet>;
+
+    static FileSet closure(FileSet const& files, Edges const& edges);
+
+    Edges m_includers; // Included file -> includers.
+    Edges m_includes; // Includer -> included files.
+    mutable std::mutex m_mut;
+};
+
+} // namespace synth
+
+#endif // SYNTH_INCLUDEGRAPH_HPP_INCLUDED
@@ -0,0 +1,161 @@
+#include "Metrics.hpp"
+
+#include "Tracer.hpp"
+#include "annotate.hpp"
+#include "memstats.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace synth;
+
+static double nsToSeconds(std::uint64_t ns)
+{
+    return static_cast<double>(ns) / 1e9;
+}
+
+static void writeHeader(
+    std::ostream& out, char const* name, char const* type, char const* help)
+{
+    out << "# HELP " << name << ' ' << help << '\n'
+        << "# TYPE " << name << ' ' << type << '\n';
+}
+
+void Metrics::countTuResult(int processTuResult)
+{
+    if (processTuResult == EXIT_SUCCESS)
+        ++tusDone;
+    else if (processTuResult == kTuNothingNew)
+        ++tusSkipped;
+    else if (processTuResult == kTuTimedOut)
+        ++tusTimedOut;
+    else
+        ++tusFailed;
+}
+
+void Metrics::writePrometheus(std::ostream& out, Tracer const* phases) const
+{
+    double elapsed = std::chrono::duration<double>(Clock::now() - start)
+        .count();
+
+    writeHeader(out, "synth_tus_planned", "gauge",
+        "Number of translation units to process.");
+    out << "synth_tus_planned " << tusPlanned << '\n';
+
+    writeHeader(out, "synth_tus_total", "counter",
+        "Translation units by processing result.");
+    out << "synth_tus_total{result=\"done\"} " << tusDone << '\n'
+        << "synth_tus_total{result=\"failed\"} " << tusFailed << '\n'
+        << "synth_tus_total{result=\"skipped\"} " << tusSkipped << '\n'
+        << "synth_tus_total{result=\"timedout\"} " << tusTimedOut << '\n';
+
+    std::uint64_t nTokens = tokens;
+    writeHeader(out, "synth_tokens_processed_total", "counter",
+        "Tokens of processed files.");
+    out << "synth_tokens_processed_total " << nTokens << '\n';
+    writeHeader(out, "synth_tokens_per_second", "gauge",
+        "Tokens processed per second since the start.");
+    out << "synth_tokens_per_second "
+        << (elapsed > 0 ? static_cast<double>(nTokens) / elapsed : 0) << '\n';
+
+    writeHeader(out, "synth_rendered_bytes_total", "counter",
+        "Bytes of HTML output written.");
+    out << "synth_rendered_bytes_total " << bytesRendered << '\n';
+
+    if (phases) {
+        writeHeader(out, "synth_phase_seconds_total", "counter",
+            "Cumulative time spent in each processing phase over all threads."
+            " Phases nest.");
+        for (auto const& phase : phases->phaseTotals()) {
+            out << "synth_phase_seconds_total{phase=\"" << phase.name << "\"} "
+                << phase.seconds << '\n';
+        }
+    }
+
+    writeHeader(out, "synth_lock_wait_seconds_total", "counter",
+        "Cumulative time spent waiting for locks over all threads.");
+    out << "synth_lock_wait_seconds_total{lock=\"shared\"} "
+        << nsToSeconds(sharedLockWaitNs) << '\n'
+        << "synth_lock_wait_seconds_total{lock=\"workingdir\"} "
+        << nsToSeconds(workingDirWaitNs) << '\n';
+
+    std::size_t rss = peakRssBytes();
+    if (rss != 0) {
+        writeHeader(out, "synth_peak_rss_bytes", "gauge",
+            "Peak resident set size of the process.");
+        out << "synth_peak_rss_bytes " << rss << '\n';
+    }
+
+    writeHeader(out, "synth_elapsed_seconds", "gauge",
+        "Time since synth was started.");
+    out << "synth_elapsed_seconds " << elapsed << '\n';
+}
+
+static auto const kMetricsWriteInterval = std::chrono::seconds(5);
+
+MetricsFileWriter::MetricsFileWriter(
+    fs::path const& fname, Metrics const& metrics, Tracer const* phases)
+    : m_fname(fs::absolute(fname))
+    , m_metrics(metrics)
+    , m_phases(phases)
+{
+    write(); // Report errors early.
+    m_thread = std::thread(&MetricsFileWriter::run, this);
+}
+
+MetricsFileWriter::~MetricsFileWriter()
+{
+    try {
+        stop();
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << '\n';
+    }
+}
+
+void MetricsFileWriter::stop()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mut);
+        m_stop = true;
+    }
+    m_stopRequested.notify_one();
+    m_thread.join();
+    write();
+}
+
+void MetricsFileWriter::write() const
+{
+    fs::path tmpName = m_fname;
+    tmpName += ".tmp";
+    {
+        fs::ofstream out(tmpName, std::ios::binary);
+        if (out)
+            m_metrics.writePrometheus(out, m_phases);
+        if (!out.flush()) {
+            throw std::runtime_error(
+                "Error writing metrics file " + tmpName.string());
+        }
+    }
+    fs::rename(tmpName, m_fname);
+}
+
+void MetricsFileWriter::run()
+{
+    std::unique_lock<std::mutex> lock(m_mut);
+    while (!m_stopRequested.wait_for(
+        lock, kMetricsWriteInterval, [this] { return m_stop; })
+    ) {
+        lock.unlock();
+        try {
+            write();
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << '\n'; // Retry next time.
+        }
+        lock.lock();
+    }
+}
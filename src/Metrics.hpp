@@ -0,0 +1,96 @@
+#ifndef SYNTH_METRICS_HPP_INCLUDED
+#define SYNTH_METRICS_HPP_INCLUDED
+
+#include <boost/filesystem/path.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+
+namespace synth {
+
+namespace fs = boost::filesystem;
+
+class Tracer;
+
+// Throughput counters, exported in the Prometheus text format.
+// All members are threadsafe.
+struct Metrics {
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<std::uint64_t> tusPlanned {0};
+    std::atomic<std::uint64_t> tusDone {0};
+    std::atomic<std::uint64_t> tusFailed {0};
+    std::atomic<std::uint64_t> tusSkipped {0};
+    std::atomic<std::uint64_t> tusTimedOut {0};
+    std::atomic<std::uint64_t> tokens {0};
+    std::atomic<std::uint64_t> bytesRendered {0};
+
+    // Time spent waiting for MultiTuProcessor's mutex and the working
+    // directory mutex (including waiting for a directory change).
+    std::atomic<std::uint64_t> sharedLockWaitNs {0};
+    std::atomic<std::uint64_t> workingDirWaitNs {0};
+
+    Clock::time_point const start = Clock::now();
+
+    // Counts a TU as done, failed, skipped or timed out according to the return
+    // value of processTu().
+    void countTuResult(int processTuResult);
+
+    // phases may be null.
+    void writePrometheus(std::ostream& out, Tracer const* phases) const;
+};
+
+// Adds the time spent waiting for mut to waitNs, if it was not immediately
+// available. waitNs may be null.
+inline std::unique_lock<std::mutex> lockCountingWait(
+    std::mutex& mut, std::atomic<std::uint64_t>* waitNs)
+{
+    std::unique_lock<std::mutex> lock(mut, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto begin = Metrics::Clock::now();
+        lock.lock();
+        if (waitNs) {
+            *waitNs += static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Metrics::Clock::now() - begin).count());
+        }
+    }
+    return lock;
+}
+
+// Writes the metrics to a file every few seconds from a background thread and
+// a final time when stop() is called or on destruction. The file is replaced
+// atomically, as required by node-exporter's textfile collector.
+class MetricsFileWriter {
+public:
+    MetricsFileWriter(
+        fs::path const& fname, Metrics const& metrics, Tracer const* phases);
+    ~MetricsFileWriter();
+
+    MetricsFileWriter(MetricsFileWriter const&) = delete;
+    MetricsFileWriter& operator= (MetricsFileWriter const&) = delete;
+
+    // Throws if writing fails.
+    void stop();
+
+private:
+    void write() const;
+    void run();
+
+    fs::path m_fname; // Absolute, since the working directory may change.
+    Metrics const& m_metrics;
+    Tracer const* m_phases;
+    bool m_stop = false;
+    std::mutex m_mut;
+    std::condition_variable m_stopRequested;
+    std::thread m_thread;
+};
+
+} // namespace synth
+
+#endif // SYNTH_METRICS_HPP_INCLUDED
@@ -1,8 +1,12 @@
 #include "MultiTuProcessor.hpp"
 
 #include "CgStr.hpp"
+#include "IncludeGraph.hpp"
+#include "Metrics.hpp"
 #include "SimpleTemplate.hpp"
+#include "Tracer.hpp"
 #include "basicHl.hpp"
+#include "memstats.hpp"
 #include "xref.hpp"
 
 #include <boost/filesystem.hpp>
@@ -10,7 +14,10 @@
 
 #include <algorithm>
 #include <climits>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 
 using namespace synth;
 
@@ -43,6 +50,50 @@ static fs::path commonPrefix(fs::path const& p1, fs::path const& p2)
     return r;
 }
 
+// Temporary file for markups moved out of memory (see setMemoryLimit()).
+class MultiTuProcessor::SpillFile {
+public:
+    explicit SpillFile(fs::path const& dir)
+        : m_path(dir / fs::unique_path("synth-spill-%%%%-%%%%-%%%%.bin"))
+    {
+        m_file.open(m_path,
+            std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!m_file)
+            throw std::runtime_error("Error creating " + m_path.string());
+    }
+
+    ~SpillFile()
+    {
+        m_file.close();
+        boost::system::error_code ec;
+        fs::remove(m_path, ec);
+    }
+
+    // Returns the offset at which data was written.
+    std::uint64_t write(std::string const& data)
+    {
+        m_file.seekp(0, std::ios::end);
+        auto offset = static_cast<std::uint64_t>(m_file.tellp());
+        m_file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!m_file)
+            throw std::runtime_error("Error writing " + m_path.string());
+        return offset;
+    }
+
+    std::string read(std::uint64_t offset, std::size_t size)
+    {
+        std::string r(size, '\0');
+        m_file.seekg(static_cast<std::streamoff>(offset));
+        if (!m_file.read(&r[0], static_cast<std::streamsize>(size)))
+            throw std::runtime_error("Error reading " + m_path.string());
+        return r;
+    }
+
+private:
+    fs::path m_path;
+    fs::fstream m_file;
+};
+
 MultiTuProcessor::MultiTuProcessor(
     PathMap const& dirs, ExternalRefLinker&& refLinker)
     : m_refLinker(std::move(refLinker))
@@ -57,6 +108,15 @@ MultiTuProcessor::MultiTuProcessor(
     }
 }
 
+MultiTuProcessor::~MultiTuProcessor() = default;
+
+void MultiTuProcessor::setMemoryLimit(
+    std::size_t maxBytes, fs::path const& spillDir)
+{
+    m_maxMarkupBytes = maxBytes;
+    m_spillFile.reset(new SpillFile(spillDir));
+}
+
 bool MultiTuProcessor::isFileIncluded(fs::path const& p) const
 {
     return getFileMapping(p) != nullptr;
@@ -76,14 +136,26 @@ SymbolDeclaration const* synth::MultiTuProcessor::referenceSymbol(
 }
 
 SymbolDeclaration& synth::MultiTuProcessor::createSymbol(
-    HighlightedFile const& hlFile, unsigned lineno, unsigned offset)
+    HighlightedFile const& hlFile, unsigned lineno, unsigned offset,
+    std::string fileUniqueName)
 {
     std::pair<SymbolMap::iterator, bool> inserted;
     {
-        std::lock_guard<std::mutex> lock(m_mut);
+        auto lock = lockShared();
         inserted = m_syms.insert({
             SymbolId{ &hlFile, offset },
             SymbolDeclaration{ &hlFile, lineno, std::string() } });
+        // The file might have been modified since (see resetFiles()).
+        if (!inserted.second)
+            inserted.first->second.lineno = lineno;
+        // Under the lock, as writeFinishedFiles() may read it meanwhile.
+        std::string& name = inserted.first->second.fileUniqueName;
+        if (name.empty())
+            name = std::move(fileUniqueName);
+        if (m_recording) {
+            m_recordedSyms.insert(
+                {&inserted.first->second, inserted.first->first});
+        }
     }
 
     return inserted.first->second;
@@ -106,106 +178,1186 @@ PathMap::value_type const* MultiTuProcessor::getFileMapping(
 HighlightedFile* MultiTuProcessor::prepareToProcess(CXFile f)
 {
     FileEntry* fentry = obtainFileEntry(f);
-    if (!fentry || fentry->processed.test_and_set())
+    if (!fentry || fentry->processed.exchange(true))
         return nullptr;
+    if (m_recording) {
+        auto lock = lockShared();
+        m_recordedFiles.push_back(fentry);
+    }
     return &fentry->hlFile;
 }
 
+bool MultiTuProcessor::needsProcessing(CXFile f)
+{
+    FileEntry* fentry = obtainFileEntry(f);
+    return fentry && !fentry->processed;
+}
+
+bool MultiTuProcessor::isFileProcessed(fs::path const& p)
+{
+    auto lock = lockShared();
+    auto mapping = getFileMapping(p);
+    if (!mapping)
+        return false;
+    // Like obtainFileEntry().
+    auto it = m_filesByPath.find(
+        mapping->first / fs::relative(p, mapping->first));
+    return it != m_filesByPath.end() && it->second->processed;
+}
+
+void MultiTuProcessor::abandonFile(CXFile f)
+{
+    FileEntry* fentry = obtainFileEntry(f);
+    assert(fentry);
+    fentry->hlFile.disabledLines.clear();
+    fentry->processed = false;
+    if (m_recording) {
+        auto lock = lockShared();
+        m_recordedFiles.erase(std::remove(
+                m_recordedFiles.begin(), m_recordedFiles.end(), fentry),
+            m_recordedFiles.end());
+    }
+}
+
 void synth::MultiTuProcessor::registerDef(
     std::string && usr, SymbolDeclaration const* def)
 {
-    std::lock_guard<std::mutex> lock(m_mut);
+    auto lock = lockShared();
+    if (m_recording)
+        m_recordedDefs.emplace_back(usr, def);
     m_defs.insert({ std::move(usr), std::move(def) });
 }
 
+void MultiTuProcessor::finishFile(CXFile f)
+{
+    // Worker processes leave this to the process that merges their results.
+    if ((!m_spillFile && !m_progressiveTpl) || m_recording)
+        return;
+    FileEntry* fentry = obtainFileEntry(f);
+    assert(fentry);
+    finishFile(*fentry);
+}
+
+std::unique_lock<std::mutex> MultiTuProcessor::lockShared()
+{
+    return lockCountingWait(
+        m_mut, m_metrics ? &m_metrics->sharedLockWaitNs : nullptr);
+}
+
 FileEntry* MultiTuProcessor::obtainFileEntry(CXFile f)
 {
     CXFileUniqueID fuid;
     if (!f || clang_getFileUniqueID(f, &fuid) != 0)
         return nullptr;
 
-    std::lock_guard<std::mutex> lock(m_mut);
-    auto it = m_processedFiles.find(fuid);
-    if (it != m_processedFiles.end())
-        return &it->second;
-    fs::path fname(CgStr(clang_getFileName(f)).gets());
+    {
+        auto lock = lockShared();
+        if (FileEntry* fentry = findFileEntry(fuid))
+            return fentry;
+    }
+    return obtainFileEntry(fuid, CgStr(clang_getFileName(f)).gets());
+}
+
+FileEntry* MultiTuProcessor::obtainFileEntry(
+    CXFileUniqueID const& fuid, fs::path fname)
+{
+    auto lock = lockShared();
+    if (FileEntry* fentry = findFileEntry(fuid))
+        return fentry;
     if (fname.empty())
         return nullptr;
     auto mapping = getFileMapping(fname);
     if (!mapping)
         return nullptr;
     fname = fs::relative(std::move(fname), mapping->first);
+    FileEntry*& byPath = m_filesByPath[mapping->first / fname];
+    if (byPath) {
+        // Another ID for a known file: It was modified (or replaced).
+        m_fuidAliases[fuid] = byPath;
+        return byPath;
+    }
     FileEntry& e = m_processedFiles.emplace(
             std::piecewise_construct,
-            std::forward_as_tuple(std::move(fuid)),
+            std::forward_as_tuple(fuid),
             std::forward_as_tuple())
         .first->second;
     e.hlFile.fname = std::move(fname);
     e.hlFile.inOutDir = mapping;
+    byPath = &e;
     return &e;
 }
 
+FileEntry* MultiTuProcessor::findFileEntry(CXFileUniqueID const& fuid)
+{
+    auto it = m_processedFiles.find(fuid);
+    if (it != m_processedFiles.end())
+        return &it->second;
+    if (m_fuidAliases.empty())
+        return nullptr;
+    auto aliasIt = m_fuidAliases.find(fuid);
+    return aliasIt == m_fuidAliases.end() ? nullptr : aliasIt->second;
+}
+
+void MultiTuProcessor::resetFiles(
+    std::unordered_set<std::string> const& srcPaths)
+{
+    std::unordered_set<HighlightedFile const*> resetHlFiles;
+    for (std::string const& srcPath : srcPaths) {
+        auto it = m_filesByPath.find(srcPath);
+        if (it == m_filesByPath.end())
+            continue;
+        FileEntry& fentry = *it->second;
+        fentry.hlFile.markups.clear();
+        fentry.hlFile.disabledLines.clear();
+        fentry.processed = false;
+        // The page of a deleted file is left alone.
+        fentry.needsOutput = fs::exists(srcPath);
+        resetHlFiles.insert(&fentry.hlFile);
+        m_resetFiles.push_back(&fentry);
+    }
+    for (auto& sym : m_syms) {
+        if (resetHlFiles.count(sym.first.file))
+            sym.second.fileUniqueName.clear();
+    }
+    for (auto it = m_defs.begin(); it != m_defs.end();) {
+        if (resetHlFiles.count(it->second->file)) {
+            m_changedUsrs.insert(it->first);
+            it = m_defs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::unordered_set<std::string> MultiTuProcessor::unprocessedResetFiles()
+{
+    std::unordered_set<std::string> r;
+    for (FileEntry* fentry : m_resetFiles) {
+        if (!fentry->processed)
+            r.insert(fentry->hlFile.srcPath().string());
+    }
+    return r;
+}
+
+static bool isSourceFileName(fs::path const& p)
+{
+    static char const* const kExtensions[] = {
+        ".c", ".cc", ".cpp", ".cxx", ".c++", ".C",
+        ".h", ".hh", ".hpp", ".hxx", ".h++", ".H",
+        ".inc", ".inl", ".ipp", ".tcc"};
+    std::string ext = p.extension().string();
+    return std::find(std::begin(kExtensions), std::end(kExtensions), ext)
+        != std::end(kExtensions);
+}
+
+std::size_t MultiTuProcessor::addAllInputFiles()
+{
+    // Real IDs consist of device, inode and modification time (see
+    // clang_getFileUniqueID()), so these do not clash with them.
+    CXFileUniqueID fuid {{~0ull, ~0ull, 0}};
+    std::size_t nAdded = 0;
+    for (auto const& dir : m_dirs) {
+        boost::system::error_code ec;
+        for (fs::recursive_directory_iterator it(dir.first, ec), end;
+            it != end;
+            it.increment(ec)
+        ) {
+            if (ec)
+                break;
+            fs::path const& p = it->path();
+            if (!isSourceFileName(p) || !fs::is_regular_file(it->status())
+                || m_filesByPath.count(p)
+            ) {
+                continue;
+            }
+            while (m_processedFiles.count(fuid))
+                ++fuid.data[2];
+            nAdded += obtainFileEntry(fuid, p) != nullptr;
+        }
+        if (ec) {
+            std::cerr << "Error listing files below " << dir.first << ": "
+                      << ec.message() << '\n';
+        }
+    }
+    return nAdded;
+}
+
+void MultiTuProcessor::markAllWritten()
+{
+    for (auto& fentry : m_processedFiles)
+        fentry.second.needsOutput = false;
+}
+
+void MultiTuProcessor::markFilesLinkingToChangedDefs()
+{
+    if (m_resetFiles.empty())
+        return;
+    // Definitions that were (re-)registered by the files are changed too.
+    std::unordered_set<HighlightedFile const*> resetHlFiles;
+    for (FileEntry const* fentry : m_resetFiles)
+        resetHlFiles.insert(&fentry->hlFile);
+    for (auto const& def : m_defs) {
+        if (resetHlFiles.count(def.second->file))
+            m_changedUsrs.insert(def.first);
+    }
+    for (auto& fentry : m_processedFiles) {
+        if (fentry.second.needsOutput)
+            continue;
+        for (Markup const& m : fentry.second.hlFile.markups) {
+            auto ref = m.refd.target<ExternalDefRef>();
+            if (ref && m_changedUsrs.count(ref->usr)) {
+                fentry.second.needsOutput = true;
+                break;
+            }
+        }
+    }
+    m_changedUsrs.clear();
+    m_resetFiles.clear();
+}
+
+// Keeps markups of the highlighters, which run on the file as it is now,
+// from ending past its end, which writeTo() would treat as an error.
+static void clampMarkups(std::vector<Markup>& markups, unsigned fileSize)
+{
+    markups.erase(
+        std::remove_if(markups.begin(), markups.end(),
+            [fileSize](Markup const& m) { return m.beginOffset >= fileSize; }),
+        markups.end());
+    for (Markup& m : markups)
+        m.endOffset = std::min(m.endOffset, fileSize);
+}
+
 void MultiTuProcessor::writeOutput(SimpleTemplate const& tpl)
 {
     if (m_dirs.empty())
         return;
+    TraceSpan outputSpan(m_tracer, "writeOutput");
+    if (m_progressiveTpl) {
+        // Links to files finished later may be missing in the pages written
+        // so far.
+        m_progressiveTpl = nullptr;
+        m_finishedFiles.clear();
+        for (auto& fentry : m_processedFiles)
+            fentry.second.needsOutput |= fentry.second.processed.load();
+    }
     auto it = m_dirs.begin();
-    fs::path rootOutDir = it->second;
+    m_rootOutDir = it->second;
     for (++it; it != m_dirs.end(); ++it)
-        rootOutDir = commonPrefix(rootOutDir, it->second);
-    bool commonRoot = !rootOutDir.empty() && isPathSuffix(
-        normalAbsolute(fs::current_path()), rootOutDir);
-    if (commonRoot && rootOutDir.empty())
-        rootOutDir = ".";
-    SimpleTemplate::Context ctx;
-    std::clog << "Writing " << m_processedFiles.size() << " HTML files...\n";
+        m_rootOutDir = commonPrefix(m_rootOutDir, it->second);
+    m_commonOutRoot = !m_rootOutDir.empty() && isPathSuffix(
+        normalAbsolute(fs::current_path()), m_rootOutDir);
+    if (m_commonOutRoot && m_rootOutDir.empty())
+        m_rootOutDir = ".";
+    markFilesLinkingToChangedDefs();
+    std::size_t nFiles = 0;
+    for (auto const& fentry : m_processedFiles)
+        nFiles += fentry.second.needsOutput;
+    std::clog << "Writing " << nFiles << " HTML files...\n";
     for (auto& fentry : m_processedFiles) {
-        auto& hlFile = fentry.second.hlFile;
-        auto dstPath = hlFile.dstPath();
-        auto hldir = dstPath.parent_path();
-        if (hldir != "." && !hldir.empty())
-            fs::create_directories(hldir);
-        sortMarkups(hlFile.markups);
-        fs::ifstream srcfile(hlFile.srcPath(), std::ios::binary);
-        fs::ofstream outfile;
+        if (!fentry.second.needsOutput)
+            continue;
+        fentry.second.needsOutput = false;
+        if (fentry.second.processed) {
+            writeFile(fentry.second, tpl);
+            continue;
+        }
+        // A file that could not even be highlighted lexically should not
+        // keep the others from being written.
         try {
-            srcfile.exceptions(std::ios::badbit);
+            writeFile(fentry.second, tpl);
+        } catch (std::exception const& e) {
+            std::cerr << "Skipping " << fentry.second.hlFile.fname << ": "
+                      << e.what() << '\n';
+        }
+    }
+}
+
+void MultiTuProcessor::startProgressiveOutput(SimpleTemplate const& tpl)
+{
+    writeOutput(tpl);
+    m_progressiveTpl = &tpl;
+}
+
+// Copies hlFile with its links evaluated, so that the copy can be rendered
+// while other threads add symbols and definitions. The fileUniqueNames its
+// markups point to are only set by the translation unit that processed
+// hlFile, so they do not change anymore once it is finished.
+static HighlightedFile withLinksResolved(
+    HighlightedFile const& hlFile, MultiTuProcessor& state)
+{
+    HighlightedFile r = hlFile;
+    fs::path outPath = r.dstPath();
+    for (Markup& m : r.markups) {
+        if (!m.isRef())
+            continue;
+        std::string url = m.refd(outPath, state);
+        if (url.empty()) {
+            m.refd = nullptr;
+            continue;
+        }
+        m.refd = [url](fs::path const&, MultiTuProcessor&) { return url; };
+    }
+    return r;
+}
+
+void MultiTuProcessor::writeFinishedFiles()
+{
+    if (!m_progressiveTpl)
+        return;
+    std::vector<HighlightedFile> hlFiles;
+    {
+        auto lock = lockShared();
+        hlFiles.reserve(m_finishedFiles.size());
+        for (FileEntry* fentry : m_finishedFiles) {
+            // E.g. abandoned again; its lexical page is still there.
+            if (fentry->processed)
+                hlFiles.push_back(withLinksResolved(fentry->hlFile, *this));
+        }
+        m_finishedFiles.clear();
+    }
+    for (HighlightedFile& hlFile : hlFiles)
+        renderFile(hlFile, /*lexical=*/ false, *m_progressiveTpl);
+}
+
+void MultiTuProcessor::writeFile(FileEntry& fentry, SimpleTemplate const& tpl)
+{
+    // Files that no translation unit processed are rendered from a copy, so
+    // that the lexical markups are not mixed with clang's if one processes
+    // the file later.
+    bool const lexical = !fentry.processed;
+    if (lexical) {
+        HighlightedFile lexicalHlFile;
+        lexicalHlFile.fname = fentry.hlFile.fname;
+        lexicalHlFile.inOutDir = fentry.hlFile.inOutDir;
+        renderFile(lexicalHlFile, lexical, tpl);
+        return;
+    }
+    bool spilled = fentry.spillSize != 0;
+    if (spilled) {
+        TraceSpan loadSpan(m_tracer, "loadSpilled");
+        loadSpilled(fentry);
+    }
+    renderFile(fentry.hlFile, lexical, tpl);
+    if (spilled) {
+        fentry.hlFile.markups = std::vector<Markup>();
+        fentry.hlFile.disabledLines = {};
+    }
+}
+
+void MultiTuProcessor::renderFile(
+    HighlightedFile& hlFile, bool lexical, SimpleTemplate const& tpl)
+{
+    TraceSpan fileSpan(m_tracer, "writeFile");
+    if (fileSpan.enabled())
+        fileSpan.addArg("file", hlFile.fname.string());
+    auto dstPath = hlFile.dstPath();
+    auto hldir = dstPath.parent_path();
+    if (hldir != "." && !hldir.empty())
+        fs::create_directories(hldir);
+    {
+        TraceSpan sortSpan(m_tracer, "sortMarkups");
+        sortMarkups(hlFile.markups);
+    }
+    // Written to a temporary file first, so that the old page is replaced
+    // atomically, e.g. while it is being viewed.
+    fs::path tmpPath = dstPath;
+    tmpPath += ".tmp";
+    // Declared before outfile, so that it is closed before.
+    struct TmpFileRemover {
+        fs::path const& path;
+        bool renamed;
+        ~TmpFileRemover() {
+            boost::system::error_code ec;
+            if (!renamed)
+                fs::remove(path, ec);
+        }
+    } tmpRemover {tmpPath, false};
+    fs::ifstream srcfile(hlFile.srcPath(), std::ios::binary);
+    fs::ofstream outfile;
+    try {
+        srcfile.exceptions(std::ios::badbit);
+        {
+            TraceSpan basicHlSpan(m_tracer, "basicHighlight");
             std::vector<Markup> suppMarkups;
-            basicHighlightFile(srcfile, suppMarkups);
+            if (lexical)
+                lexicalHighlightFile(srcfile, suppMarkups);
+            else
+                basicHighlightFile(srcfile, suppMarkups);
+            srcfile.clear();
+            srcfile.seekg(0, std::ios::end);
+            clampMarkups(
+                suppMarkups, static_cast<unsigned>(srcfile.tellg()));
             sortMarkups(suppMarkups);
             hlFile.supplementMarkups(suppMarkups);
-            srcfile.clear();
-            srcfile.seekg(0);
-            outfile.open(dstPath, std::ios::binary);
-            outfile.exceptions(std::ios::badbit | std::ios::failbit);
-            ctx["code"] = SimpleTemplate::ValCallback(std::bind(
-                &HighlightedFile::writeTo,
-                &hlFile,
-                std::placeholders::_1,
-                std::ref(*this),
-                std::ref(srcfile)));
-            ctx["filename"] = hlFile.fname.string();
-            fs::path rootpath = fs::relative(
-                    commonRoot ? rootOutDir : hlFile.inOutDir->second, hldir)
-                .lexically_normal();
-            ctx["rootpath"] = rootpath.empty() ? "." : rootpath.string();
-            tpl.writeTo(outfile, ctx);
-        } catch (std::ios::failure const& e) {
-            if (!srcfile) {
-                throw std::runtime_error(
-                    "Error reading from or opening "
-                    + hlFile.srcPath().string()
-                    + ": " + e.what());
-            }
-            if (!outfile) {
-                throw std::runtime_error(
-                    "Error writing to or opening "
-                    + hlFile.dstPath().string()
-                    + ": " + e.what());
-            }
-            assert("ios::failure but no file with badbit or failbit" && false);
-            throw;
         }
+        srcfile.clear();
+        srcfile.seekg(0);
+        outfile.open(tmpPath, std::ios::binary);
+        outfile.exceptions(std::ios::badbit | std::ios::failbit);
+        SimpleTemplate::Context ctx;
+        ctx["code"] = SimpleTemplate::ValCallback(std::bind(
+            &HighlightedFile::writeTo,
+            &hlFile,
+            std::placeholders::_1,
+            std::ref(*this),
+            std::ref(srcfile)));
+        ctx["filename"] = hlFile.fname.string();
+        fs::path rootpath = fs::relative(
+                m_commonOutRoot ? m_rootOutDir : hlFile.inOutDir->second,
+                hldir)
+            .lexically_normal();
+        ctx["rootpath"] = rootpath.empty() ? "." : rootpath.string();
+        TraceSpan renderSpan(m_tracer, "render");
+        tpl.writeTo(outfile, ctx);
+        if (m_metrics) {
+            m_metrics->bytesRendered += static_cast<std::uint64_t>(
+                outfile.tellp());
+        }
+        outfile.close();
+    } catch (std::ios::failure const& e) {
+        if (!srcfile) {
+            throw std::runtime_error(
+                "Error reading from or opening "
+                + hlFile.srcPath().string()
+                + ": " + e.what());
+        }
+        if (!outfile) {
+            throw std::runtime_error(
+                "Error writing to or opening "
+                + tmpPath.string()
+                + ": " + e.what());
+        }
+        assert("ios::failure but no file with badbit or failbit" && false);
+        throw;
+    }
+    fs::rename(tmpPath, dstPath);
+    tmpRemover.renamed = true;
+}
+
+void MultiTuProcessor::addMemoryStats(MemoryStats& stats) const
+{
+    stats.files.count += m_processedFiles.size();
+    stats.files.bytes += unorderedMapBytes(m_processedFiles);
+    for (auto const& fentry : m_processedFiles) {
+        HighlightedFile const& hlFile = fentry.second.hlFile;
+        stats.files.bytes += stringHeapBytes(hlFile.fname.string())
+            + hlFile.disabledLines.capacity()
+                * sizeof(hlFile.disabledLines.front());
+        stats.markups.count += hlFile.markups.size();
+        stats.markups.bytes += hlFile.markups.capacity() * sizeof(Markup);
+        for (Markup const& m : hlFile.markups) {
+            if (!m.isRef())
+                continue;
+            ++stats.codeRefs.count;
+            stats.codeRefs.bytes += codeRefHeapBytes(m.refd);
+        }
+    }
+
+    stats.symbols.count += m_syms.size();
+    stats.symbols.bytes += unorderedMapBytes(m_syms);
+    for (auto const& sym : m_syms) {
+        std::string const& name = sym.second.fileUniqueName;
+        if (name.empty())
+            continue;
+        ++stats.fileUniqueNames.count;
+        stats.fileUniqueNames.bytes += stringHeapBytes(name);
+    }
+
+    stats.defs.count += m_defs.size();
+    stats.defs.bytes += unorderedMapBytes(m_defs);
+    for (auto const& def : m_defs)
+        stats.defs.bytes += stringHeapBytes(def.first);
+}
+
+void MultiTuProcessor::startRecording()
+{
+    m_recording = true;
+    m_recordedFiles.clear();
+    m_recordedSyms.clear();
+    m_recordedDefs.clear();
+}
+
+// Results are only exchanged between processes of the same executable on the
+// same machine (and spilled files are only read back by the process that
+// wrote them), so integers are simply stored in native byte order.
+
+namespace {
+
+std::uint32_t const kResultMagic = 0x53795452;
+std::uint32_t const kIndexMagic = 0x53794958;
+std::uint32_t const kIndexVersion = 3;
+std::uint64_t const kNoSymbol = UINT64_MAX;
+
+enum class LinkKind : std::uint8_t { none, symbol, externalDef, url };
+
+class ResultReader {
+public:
+    ResultReader(char const* data, std::size_t size)
+        : m_pos(data), m_end(data + size)
+    { }
+
+    template <typename T>
+    T get()
+    {
+        T r;
+        require(sizeof(r));
+        std::memcpy(&r, m_pos, sizeof(r));
+        m_pos += sizeof(r);
+        return r;
+    }
+
+    std::string getString()
+    {
+        auto sz = get<std::uint32_t>();
+        require(sz);
+        std::string r(m_pos, sz);
+        m_pos += sz;
+        return r;
+    }
+
+    // Reads an index that must be less than n.
+    template <typename T>
+    T getIndex(std::uint64_t n)
+    {
+        auto idx = get<T>();
+        if (idx >= n)
+            throw std::runtime_error("Malformed data: Index out of range.");
+        return idx;
+    }
+
+    bool atEnd() const { return m_pos == m_end; }
+
+private:
+    void require(std::size_t sz) const
+    {
+        if (static_cast<std::size_t>(m_end - m_pos) < sz)
+            throw std::runtime_error("Truncated data.");
+    }
+
+    char const* m_pos;
+    char const* m_end;
+};
+
+struct ResultLink {
+    LinkKind kind;
+    std::uint64_t sym; // LinkKind::symbol.
+    std::string str; // USR for LinkKind::externalDef, else URL.
+    std::unique_ptr<ResultLink> extRef; // LinkKind::externalDef.
+};
+
+struct ResultMarkup {
+    unsigned beginOffset;
+    unsigned endOffset;
+    TokenAttributes attrs;
+    std::uint64_t nameSym; // kNoSymbol if none.
+    ResultLink link;
+};
+
+struct ResultFile {
+    CXFileUniqueID fuid;
+    std::string path;
+};
+
+struct ResultSymbol {
+    std::uint32_t file;
+    unsigned lineno;
+    unsigned offset;
+    std::string fileUniqueName;
+};
+
+struct ResultContents {
+    std::vector<std::pair<unsigned, unsigned>> disabledLines;
+    std::vector<ResultMarkup> markups;
+};
+
+struct ResultDef {
+    std::string usr;
+    std::uint64_t sym;
+};
+
+using Inclusions = std::vector<std::pair<std::string, std::string>>;
+
+} // anonymous namespace
+
+template <typename T>
+static void putRaw(std::string& out, T v)
+{
+    out.append(reinterpret_cast<char const*>(&v), sizeof(v));
+}
+
+static void putString(std::string& out, std::string const& s)
+{
+    putRaw(out, static_cast<std::uint32_t>(s.size()));
+    out += s;
+}
+
+// symId maps the target of a SymbolRef to an ID that the reader can map back.
+// Links that are neither to symbols nor to definitions are stored as the URL
+// they evaluate to for outPath.
+template <typename SymIdFn>
+static void putLink(
+    std::string& out,
+    CodeRef const& ref,
+    fs::path const& outPath,
+    MultiTuProcessor& state,
+    SymIdFn& symId)
+{
+    if (!ref) {
+        putRaw(out, LinkKind::none);
+    } else if (auto symRef = ref.target<SymbolRef>()) {
+        putRaw(out, LinkKind::symbol);
+        putRaw(out, static_cast<std::uint64_t>(symId(symRef->sym)));
+    } else if (auto extDef = ref.target<ExternalDefRef>()) {
+        putRaw(out, LinkKind::externalDef);
+        putString(out, extDef->usr);
+        putLink(out, extDef->extRef, outPath, state, symId);
+    } else {
+        putRaw(out, LinkKind::url);
+        putString(out, ref(outPath, state));
+    }
+}
+
+// Writes the markups and disabled lines of hlFile. nameId maps the
+// fileUniqueName of a markup to an ID like symId does for symbols.
+template <typename SymIdFn, typename NameIdFn>
+static void putContents(
+    std::string& out,
+    HighlightedFile const& hlFile,
+    MultiTuProcessor& state,
+    SymIdFn&& symId,
+    NameIdFn&& nameId)
+{
+    fs::path outPath = hlFile.dstPath();
+    putRaw(out, static_cast<std::uint32_t>(hlFile.disabledLines.size()));
+    for (auto const& lines : hlFile.disabledLines) {
+        putRaw(out, static_cast<std::uint32_t>(lines.first));
+        putRaw(out, static_cast<std::uint32_t>(lines.second));
+    }
+    putRaw(out, static_cast<std::uint32_t>(hlFile.markups.size()));
+    for (Markup const& m : hlFile.markups) {
+        putRaw(out, static_cast<std::uint32_t>(m.beginOffset));
+        putRaw(out, static_cast<std::uint32_t>(m.endOffset));
+        putRaw(out, m.attrs);
+        putRaw(out, m.fileUniqueName
+            ? static_cast<std::uint64_t>(nameId(m.fileUniqueName))
+            : kNoSymbol);
+        putLink(out, m.refd, outPath, state, symId);
+    }
+}
+
+// Writes the (file, includer) pairs of includeGraph, if any, with each path
+// stored only once.
+static void putInclusions(std::string& out, IncludeGraph const* includeGraph)
+{
+    Inclusions inclusions;
+    if (includeGraph)
+        inclusions = includeGraph->inclusions();
+    std::unordered_map<std::string, std::uint32_t> pathIndices;
+    std::string pairs;
+    for (auto const& inclusion : inclusions) {
+        for (std::string const* path : {&inclusion.first, &inclusion.second}) {
+            auto const idx = static_cast<std::uint32_t>(pathIndices.size());
+            putRaw(pairs, pathIndices.insert({*path, idx}).first->second);
+        }
+    }
+    std::vector<std::string const*> paths(pathIndices.size());
+    for (auto const& path : pathIndices)
+        paths[path.second] = &path.first;
+    putRaw(out, static_cast<std::uint32_t>(paths.size()));
+    for (std::string const* path : paths)
+        putString(out, *path);
+    putRaw(out, static_cast<std::uint64_t>(inclusions.size()));
+    out += pairs;
+}
+
+static Inclusions readInclusions(ResultReader& in)
+{
+    std::vector<std::string> paths;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n)
+        paths.push_back(in.getString());
+    Inclusions r;
+    for (auto n = in.get<std::uint64_t>(); n > 0; --n) {
+        auto file = in.getIndex<std::uint32_t>(paths.size());
+        auto includer = in.getIndex<std::uint32_t>(paths.size());
+        r.emplace_back(paths[file], paths[includer]);
+    }
+    return r;
+}
+
+template <typename T>
+static std::uint32_t indexOf(
+    T const* p,
+    std::vector<T const*>& all,
+    std::unordered_map<T const*, std::uint32_t>& indices)
+{
+    auto inserted = indices.insert(
+        {p, static_cast<std::uint32_t>(all.size())});
+    if (inserted.second)
+        all.push_back(p);
+    return inserted.first->second;
+}
+
+void MultiTuProcessor::writeRecordedResult(std::string& out)
+{
+    std::vector<HighlightedFile const*> files;
+    std::unordered_map<HighlightedFile const*, std::uint32_t> fileIndices;
+    std::vector<SymbolDeclaration const*> syms;
+    std::unordered_map<SymbolDeclaration const*, std::uint32_t> symIndices;
+    auto symIndex = [&](SymbolDeclaration const* sym) {
+        indexOf(sym->file, files, fileIndices);
+        return indexOf(sym, syms, symIndices);
+    };
+
+    std::unordered_map<std::string const*, SymbolDeclaration const*> names;
+    for (auto const& sym : m_recordedSyms)
+        names[&sym.first->fileUniqueName] = sym.first;
+    auto const nameIndex = [&](std::string const* name) {
+        auto it = names.find(name);
+        assert(it != names.end());
+        return it == names.end() ? kNoSymbol : symIndex(it->second);
+    };
+
+    // Written after the file and symbol tables, which are filled meanwhile.
+    std::string body;
+    putRaw(body, static_cast<std::uint32_t>(m_recordedFiles.size()));
+    for (FileEntry const* fentry : m_recordedFiles) {
+        putRaw(body, indexOf(&fentry->hlFile, files, fileIndices));
+        putContents(body, fentry->hlFile, *this, symIndex, nameIndex);
+    }
+    putRaw(body, static_cast<std::uint32_t>(m_recordedDefs.size()));
+    for (auto const& def : m_recordedDefs) {
+        putString(body, def.first);
+        putRaw(body, symIndex(def.second));
+    }
+    putInclusions(body, m_includeGraph);
+
+    std::unordered_map<HighlightedFile const*, CXFileUniqueID const*> fuids;
+    for (auto const& fentry : m_processedFiles)
+        fuids[&fentry.second.hlFile] = &fentry.first;
+
+    putRaw(out, kResultMagic);
+    putRaw(out, static_cast<std::uint32_t>(files.size()));
+    for (HighlightedFile const* hlFile : files) {
+        for (auto d : fuids.at(hlFile)->data)
+            putRaw(out, static_cast<std::uint64_t>(d));
+        putString(out, hlFile->srcPath().string());
+    }
+    putRaw(out, static_cast<std::uint32_t>(syms.size()));
+    for (SymbolDeclaration const* sym : syms) {
+        putRaw(out, fileIndices.at(sym->file));
+        putRaw(out, static_cast<std::uint32_t>(sym->lineno));
+        putRaw(out, static_cast<std::uint32_t>(m_recordedSyms.at(sym).offset));
+        putString(out, sym->fileUniqueName);
+    }
+    out += body;
+}
+
+static ResultLink readLink(ResultReader& in, std::uint64_t nSyms)
+{
+    ResultLink r {in.get<LinkKind>(), 0, std::string(), nullptr};
+    if (r.kind == LinkKind::symbol) {
+        r.sym = in.getIndex<std::uint64_t>(nSyms);
+    } else if (r.kind == LinkKind::externalDef) {
+        r.str = in.getString();
+        r.extRef.reset(new ResultLink(readLink(in, nSyms)));
+    } else if (r.kind == LinkKind::url) {
+        r.str = in.getString();
+    } else if (r.kind != LinkKind::none) {
+        throw std::runtime_error("Malformed data: Bad link kind.");
     }
+    return r;
 }
 
+// Symbol IDs are checked to be less than nSyms.
+static ResultContents readContents(ResultReader& in, std::uint64_t nSyms)
+{
+    ResultContents r;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        std::uint32_t first = in.get<std::uint32_t>();
+        r.disabledLines.emplace_back(first, in.get<std::uint32_t>());
+    }
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        ResultMarkup m;
+        m.beginOffset = in.get<std::uint32_t>();
+        m.endOffset = in.get<std::uint32_t>();
+        m.attrs = in.get<TokenAttributes>();
+        m.nameSym = in.get<std::uint64_t>();
+        if (m.nameSym != kNoSymbol && m.nameSym >= nSyms)
+            throw std::runtime_error("Malformed data: Index out of range.");
+        m.link = readLink(in, nSyms);
+        r.markups.push_back(std::move(m));
+    }
+    return r;
+}
+
+// symFor maps symbol IDs back to symbols (or nullptr to drop the link).
+template <typename SymFn>
+static CodeRef toCodeRef(ResultLink& link, SymFn& symFor)
+{
+    if (link.kind == LinkKind::symbol) {
+        if (SymbolDeclaration const* sym = symFor(link.sym))
+            return SymbolRef {sym};
+    } else if (link.kind == LinkKind::externalDef) {
+        return ExternalDefRef {
+            std::move(link.str), toCodeRef(*link.extRef, symFor)};
+    } else if (link.kind == LinkKind::url) {
+        return UrlRef {std::move(link.str)};
+    }
+    return CodeRef();
+}
+
+template <typename SymFn, typename NameFn>
+static void addContents(
+    ResultContents&& contents,
+    HighlightedFile& hlFile,
+    SymFn&& symFor,
+    NameFn&& nameFor)
+{
+    hlFile.disabledLines = std::move(contents.disabledLines);
+    hlFile.markups.reserve(hlFile.markups.size() + contents.markups.size());
+    for (ResultMarkup& m : contents.markups) {
+        hlFile.markups.push_back({
+            m.beginOffset,
+            m.endOffset,
+            m.attrs,
+            m.nameSym == kNoSymbol ? nullptr : nameFor(m.nameSym),
+            toCodeRef(m.link, symFor)});
+    }
+}
+
+void MultiTuProcessor::mergeResult(char const* data, std::size_t size)
+{
+    ResultReader in(data, size);
+    if (in.get<std::uint32_t>() != kResultMagic)
+        throw std::runtime_error("Malformed data: Bad magic number.");
+
+    std::vector<ResultFile> files;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        files.emplace_back();
+        for (auto& d : files.back().fuid.data)
+            d = in.get<std::uint64_t>();
+        files.back().path = in.getString();
+    }
+    std::vector<ResultSymbol> syms;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        auto file = in.getIndex<std::uint32_t>(files.size());
+        std::uint32_t lineno = in.get<std::uint32_t>();
+        std::uint32_t offset = in.get<std::uint32_t>();
+        syms.push_back({file, lineno, offset, in.getString()});
+    }
+    std::vector<std::pair<std::uint32_t, ResultContents>> contents;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        auto file = in.getIndex<std::uint32_t>(files.size());
+        contents.emplace_back(file, readContents(in, syms.size()));
+    }
+    std::vector<ResultDef> defs;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        std::string usr = in.getString();
+        defs.push_back({
+            std::move(usr), in.getIndex<std::uint32_t>(syms.size())});
+    }
+    Inclusions inclusions = readInclusions(in);
+    if (!in.atEnd())
+        throw std::runtime_error("Malformed data: Trailing data.");
+
+    // Everything was read successfully, now merge.
+    std::vector<FileEntry*> entries;
+    entries.reserve(files.size());
+    for (ResultFile const& f : files)
+        entries.push_back(obtainFileEntry(f.fuid, f.path));
+    std::vector<bool> accepted(files.size());
+    for (auto const& c : contents) {
+        FileEntry* fentry = entries[c.first];
+        accepted[c.first] = fentry && !fentry->processed.exchange(true);
+    }
+    std::vector<SymbolDeclaration const*> symPtrs;
+    symPtrs.reserve(syms.size());
+    for (ResultSymbol& sym : syms) {
+        FileEntry* fentry = entries[sym.file];
+        if (!fentry) {
+            symPtrs.push_back(nullptr);
+            continue;
+        }
+        // Only the translation unit that processed a file names its symbols.
+        SymbolDeclaration& decl = createSymbol(
+            fentry->hlFile, sym.lineno, sym.offset,
+            accepted[sym.file] ? std::move(sym.fileUniqueName) : std::string());
+        symPtrs.push_back(&decl);
+    }
+    for (auto& c : contents) {
+        if (!accepted[c.first])
+            continue;
+        addContents(
+            std::move(c.second),
+            entries[c.first]->hlFile,
+            [&](std::uint64_t idx) { return symPtrs[idx]; },
+            [&](std::uint64_t idx) {
+                return symPtrs[idx] ? &symPtrs[idx]->fileUniqueName : nullptr;
+            });
+        finishFile(*entries[c.first]);
+    }
+    for (ResultDef& def : defs) {
+        if (symPtrs[def.sym])
+            registerDef(std::move(def.usr), symPtrs[def.sym]);
+    }
+    if (m_includeGraph) {
+        for (auto const& inclusion : inclusions)
+            m_includeGraph->addInclusion(inclusion.first, inclusion.second);
+    }
+}
+
+static std::size_t markupBytes(HighlightedFile const& hlFile)
+{
+    std::size_t r = hlFile.markups.capacity() * sizeof(Markup)
+        + hlFile.disabledLines.capacity() * sizeof(hlFile.disabledLines[0]);
+    for (Markup const& m : hlFile.markups)
+        r += codeRefHeapBytes(m.refd);
+    return r;
+}
+
+// Spilled markups are read back by the same process, so symbols and their
+// fileUniqueNames are simply identified by their addresses, which are stable
+// since m_syms is never erased from.
+
+static std::uint64_t addressId(void const* p)
+{
+    return reinterpret_cast<std::uintptr_t>(p);
+}
+
+template <typename T>
+static T const* fromAddressId(std::uint64_t id)
+{
+    return reinterpret_cast<T const*>(static_cast<std::uintptr_t>(id));
+}
+
+void MultiTuProcessor::finishFile(FileEntry& fentry)
+{
+    if (m_progressiveTpl) {
+        auto lock = lockShared();
+        m_finishedFiles.push_back(&fentry);
+    }
+    if (m_spillFile)
+        spillIfOverLimit(fentry);
+}
+
+void MultiTuProcessor::spillIfOverLimit(FileEntry& fentry)
+{
+    HighlightedFile& hlFile = fentry.hlFile;
+    std::size_t sz = markupBytes(hlFile);
+    if (m_markupBytes.fetch_add(sz) + sz <= m_maxMarkupBytes)
+        return;
+    std::string data;
+    putContents(data, hlFile, *this, &addressId, &addressId);
+    {
+        auto lock = lockShared();
+        fentry.spillOffset = m_spillFile->write(data);
+    }
+    fentry.spillSize = data.size();
+    m_markupBytes -= sz;
+    hlFile.markups = std::vector<Markup>();
+    hlFile.disabledLines = {};
+}
+
+void MultiTuProcessor::loadSpilled(FileEntry& fentry)
+{
+    std::string data = m_spillFile->read(
+        fentry.spillOffset, static_cast<std::size_t>(fentry.spillSize));
+    ResultReader in(data.data(), data.size());
+    addContents(
+        readContents(in, /*nSyms=*/ kNoSymbol),
+        fentry.hlFile,
+        &fromAddressId<SymbolDeclaration>,
+        &fromAddressId<std::string>);
+}
+
+// Unlike results and spilled files, the index may be read by another process,
+// so all references are indices.
+void MultiTuProcessor::writeIndex(std::ostream& out)
+{
+    std::unordered_map<PathMap::value_type const*, std::uint32_t> dirIndices;
+    std::unordered_map<HighlightedFile const*, std::uint32_t> fileIndices;
+    std::unordered_map<SymbolDeclaration const*, std::uint64_t> symIndices;
+    std::unordered_map<std::string const*, std::uint64_t> nameIndices;
+    for (auto const& dir : m_dirs) {
+        dirIndices.insert(
+            {&dir, static_cast<std::uint32_t>(dirIndices.size())});
+    }
+    for (auto const& fentry : m_processedFiles) {
+        fileIndices.insert({
+            &fentry.second.hlFile,
+            static_cast<std::uint32_t>(fileIndices.size())});
+    }
+
+    std::string data;
+    putRaw(data, kIndexMagic);
+    putRaw(data, kIndexVersion);
+    putRaw(data, static_cast<std::uint32_t>(m_dirs.size()));
+    for (auto const& dir : m_dirs) {
+        putString(data, dir.first.string());
+        putString(data, dir.second.string());
+    }
+    putRaw(data, static_cast<std::uint64_t>(m_syms.size()));
+    for (auto const& sym : m_syms) {
+        nameIndices.insert({&sym.second.fileUniqueName, symIndices.size()});
+        symIndices.insert({&sym.second, symIndices.size()});
+        putRaw(data, fileIndices.at(sym.first.file));
+        putRaw(data, static_cast<std::uint32_t>(sym.second.lineno));
+        putRaw(data, static_cast<std::uint32_t>(sym.first.offset));
+        putString(data, sym.second.fileUniqueName);
+    }
+    putRaw(data, static_cast<std::uint64_t>(m_defs.size()));
+    for (auto const& def : m_defs) {
+        putString(data, def.first);
+        putRaw(data, symIndices.at(def.second));
+    }
+    putInclusions(data, m_includeGraph);
+
+    // Files come last, so that they can be written one at a time.
+    putRaw(data, static_cast<std::uint32_t>(m_processedFiles.size()));
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    for (auto& fentry : m_processedFiles) {
+        HighlightedFile const& hlFile = fentry.second.hlFile;
+        bool spilled = fentry.second.spillSize != 0;
+        if (spilled)
+            loadSpilled(fentry.second);
+        data.clear();
+        for (auto d : fentry.first.data)
+            putRaw(data, static_cast<std::uint64_t>(d));
+        putString(data, hlFile.fname.string());
+        putRaw(data, dirIndices.at(hlFile.inOutDir));
+        // Files that were only referenced must not win over processed ones
+        // when indexes are merged.
+        putRaw(data, fentry.second.processed.load());
+        putContents(
+            data,
+            hlFile,
+            *this,
+            [&](SymbolDeclaration const* sym) { return symIndices.at(sym); },
+            [&](std::string const* name) { return nameIndices.at(name); });
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (spilled) {
+            fentry.second.hlFile.markups = std::vector<Markup>();
+            fentry.second.hlFile.disabledLines = {};
+        }
+    }
+}
+
+void MultiTuProcessor::loadIndex(char const* data, std::size_t size)
+{
+    bool merging = !m_dirs.empty();
+    ResultReader in(data, size);
+    if (in.get<std::uint32_t>() != kIndexMagic)
+        throw std::runtime_error("Not a synth index.");
+    auto version = in.get<std::uint32_t>();
+    if (version != kIndexVersion) {
+        throw std::runtime_error(
+            "Unsupported index version " + std::to_string(version)
+            + " (expected " + std::to_string(kIndexVersion) + ").");
+    }
+
+    PathMap dirs;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        fs::path inDir = in.getString();
+        dirs.push_back({std::move(inDir), in.getString()});
+    }
+    if (merging && dirs != m_dirs) {
+        // Otherwise, m_dirs could not be extended without invalidating the
+        // HighlightedFile::inOutDir pointers into it.
+        throw std::runtime_error(
+            "Merged indexes must have the same input and output directories.");
+    }
+    std::vector<ResultSymbol> syms;
+    for (auto n = in.get<std::uint64_t>(); n > 0; --n) {
+        auto file = in.get<std::uint32_t>();
+        std::uint32_t lineno = in.get<std::uint32_t>();
+        std::uint32_t offset = in.get<std::uint32_t>();
+        syms.push_back({file, lineno, offset, in.getString()});
+    }
+    std::vector<ResultDef> defs;
+    for (auto n = in.get<std::uint64_t>(); n > 0; --n) {
+        std::string usr = in.getString();
+        defs.push_back({
+            std::move(usr), in.getIndex<std::uint64_t>(syms.size())});
+    }
+    Inclusions inclusions = readInclusions(in);
+
+    struct IndexFile {
+        fs::path fname;
+        std::uint32_t dirIdx;
+        CXFileUniqueID fuid;
+        bool processed;
+        ResultContents contents;
+    };
+    std::vector<IndexFile> files;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+        files.emplace_back();
+        IndexFile& f = files.back();
+        for (auto& d : f.fuid.data)
+            d = in.get<std::uint64_t>();
+        f.fname = in.getString();
+        f.dirIdx = in.getIndex<std::uint32_t>(dirs.size());
+        f.processed = in.get<bool>();
+        f.contents = readContents(in, syms.size());
+    }
+    if (!in.atEnd())
+        throw std::runtime_error("Malformed data: Trailing data.");
+    for (ResultSymbol const& sym : syms) {
+        if (sym.file >= files.size())
+            throw std::runtime_error("Malformed data: Index out of range.");
+    }
+
+    if (!merging) {
+        m_dirs = std::move(dirs);
+        for (auto const& dir : m_dirs) {
+            m_rootInDir = &dir == &m_dirs.front()
+                ? dir.first : commonPrefix(std::move(m_rootInDir), dir.first);
+        }
+    }
+
+    // File IDs differ between machines, so merged files are matched by path.
+    std::vector<FileEntry*> entries;
+    std::vector<bool> accepted;
+    for (IndexFile& f : files) {
+        FileEntry*& fentry = m_filesByPath[m_dirs[f.dirIdx].first / f.fname];
+        if (!fentry) {
+            // Another file of a merged index might have this ID.
+            while (m_processedFiles.count(f.fuid))
+                ++f.fuid.data[2];
+            fentry = &m_processedFiles.emplace(
+                    std::piecewise_construct,
+                    std::forward_as_tuple(f.fuid),
+                    std::forward_as_tuple())
+                .first->second;
+            fentry->hlFile.fname = std::move(f.fname);
+            fentry->hlFile.inOutDir = &m_dirs[f.dirIdx];
+        }
+        entries.push_back(fentry);
+        // Like prepareToProcess(): The first index that processed a file wins.
+        accepted.push_back(f.processed && !fentry->processed.exchange(true));
+    }
+
+    std::vector<SymbolDeclaration const*> symPtrs;
+    symPtrs.reserve(syms.size());
+    for (ResultSymbol& sym : syms) {
+        SymbolDeclaration& decl = createSymbol(
+            entries[sym.file]->hlFile, sym.lineno, sym.offset);
+        if (accepted[sym.file] && decl.fileUniqueName.empty())
+            decl.fileUniqueName = std::move(sym.fileUniqueName);
+        symPtrs.push_back(&decl);
+    }
+    for (ResultDef& def : defs)
+        m_defs.insert({std::move(def.usr), symPtrs[def.sym]});
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!accepted[i])
+            continue;
+        addContents(
+            std::move(files[i].contents),
+            entries[i]->hlFile,
+            [&](std::uint64_t idx) { return symPtrs[idx]; },
+            [&](std::uint64_t idx) { return &symPtrs[idx]->fileUniqueName; });
+    }
+    if (m_includeGraph) {
+        for (auto const& inclusion : inclusions)
+            m_includeGraph->addInclusion(inclusion.first, inclusion.second);
+    }
+}
@@ -8,6 +8,9 @@
 #include <clang-c/Index.h>
 
 #include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -16,13 +19,24 @@
 
 namespace synth {
 
+class IncludeGraph;
 class SimpleTemplate;
+class Tracer;
+struct MemoryStats;
+struct Metrics;
 
 namespace fs = boost::filesystem;
 
 struct FileEntry {
-    std::atomic_flag processed;
+    std::atomic<bool> processed {false};
     HighlightedFile hlFile;
+
+    // Where hlFile's markups and disabled lines are in the spill file, if
+    // they were moved there (see MultiTuProcessor::setMemoryLimit()).
+    std::uint64_t spillOffset = 0;
+    std::uint64_t spillSize = 0; // 0: Not spilled.
+
+    bool needsOutput = true; // Cleared by MultiTuProcessor::writeOutput().
 };
 
 using PathMap = std::vector<std::pair<fs::path, fs::path>>;
@@ -54,11 +68,34 @@ class MultiTuProcessor {
 public:
     explicit MultiTuProcessor(
         PathMap const& rootdir_, ExternalRefLinker&& refLinker);
+    ~MultiTuProcessor();
 
     // Setter is not threadsafe!
     void setMaxIdSz(std::size_t maxIdSz) noexcept { m_maxIdSz = maxIdSz; }
     std::size_t maxIdSz() const noexcept { return m_maxIdSz; }
 
+    // Once the markups of processed files take more than about maxBytes, the
+    // markups and disabled lines of files finished afterwards are moved to a
+    // temporary file in spillDir, to be read back one at a time by
+    // writeOutput(). Not threadsafe!
+    void setMemoryLimit(std::size_t maxBytes, fs::path const& spillDir);
+
+    // Setter is not threadsafe! Pass nullptr to disable tracing.
+    void setTracer(Tracer* tracer) noexcept { m_tracer = tracer; }
+    Tracer* tracer() const noexcept { return m_tracer; }
+
+    // Setter is not threadsafe! Pass nullptr to disable metrics.
+    void setMetrics(Metrics* metrics) noexcept { m_metrics = metrics; }
+    Metrics* metrics() const noexcept { return m_metrics; }
+
+    // Setter is not threadsafe! If set, processTu() records all inclusions in
+    // includeGraph.
+    void setIncludeGraph(IncludeGraph* includeGraph) noexcept
+    {
+        m_includeGraph = includeGraph;
+    }
+    IncludeGraph* includeGraph() const noexcept { return m_includeGraph; }
+
     bool isFileIncluded(fs::path const& p) const;
 
     // Returns nullptr if references to f should be ignored.
@@ -67,16 +104,72 @@ public:
     SymbolDeclaration const* referenceSymbol(
         CXFile f, unsigned lineno, unsigned offset);
 
+    // fileUniqueName is only set if the symbol does not have one yet.
     SymbolDeclaration& createSymbol(
-        HighlightedFile const& hlFile, unsigned lineno, unsigned offset);
+        HighlightedFile const& hlFile, unsigned lineno, unsigned offset,
+        std::string fileUniqueName = std::string());
 
     HighlightedFile* prepareToProcess(CXFile f);
 
+    // Returns true if f is in an input directory and was not processed by any
+    // translation unit yet, i.e. if prepareToProcess() would return it.
+    bool needsProcessing(CXFile f);
+
+    // Returns true if the file at p was already processed by a translation
+    // unit. Relative paths are interpreted relative to the current directory.
+    bool isFileProcessed(fs::path const& p);
+
+    // Makes f available to prepareToProcess() again, e.g. because the results
+    // of the translation unit that prepared it were discarded. Must only be
+    // called from that translation unit before any markups were added.
+    void abandonFile(CXFile f);
+
     void registerDef(std::string&& usr, SymbolDeclaration const* def);
 
+    // Called by processTu() after it added all markups of f, which it
+    // obtained from prepareToProcess().
+    void finishFile(CXFile f);
+
+    // Forgets the markups, disabled lines, symbol names and definitions of
+    // the files with the given paths (see IncludeGraph::normalize()), so that
+    // they are processed again by the next translation unit that includes
+    // them, even if their CXFileUniqueID changed because they were modified.
+    // They are written by the next writeOutput(), together with the files
+    // that link to the forgotten definitions. Not threadsafe!
+    void resetFiles(std::unordered_set<std::string> const& srcPaths);
+
+    // Returns the paths of the files reset by resetFiles() that no
+    // translation unit processed since. Not threadsafe!
+    std::unordered_set<std::string> unprocessedResetFiles();
+
+    // Adds all C and C++ files below the input directories that are not known
+    // yet, so that writeOutput() also writes those that no translation unit
+    // includes. Files that no translation unit processed are highlighted
+    // lexically (see lexicalHighlightFile()). Returns the number of added
+    // files. Not threadsafe!
+    std::size_t addAllInputFiles();
+
+    // Makes writeOutput() skip all files added so far, unless they are reset,
+    // e.g. because their output was written by an earlier run.
+    // Not threadsafe!
+    void markAllWritten();
+
+    // Writes all files that were not written since they were added or reset.
+    // Ends progressive output, rewriting the files written by
+    // writeFinishedFiles() with links to files that were finished later.
     // Not threadsafe!
     void writeOutput(SimpleTemplate const& tpl);
 
+    // Calls writeOutput() and makes finishFile() queue files for
+    // writeFinishedFiles() from then on. tpl must outlive the object or
+    // the next call to writeOutput(). Not threadsafe!
+    void startProgressiveOutput(SimpleTemplate const& tpl);
+
+    // Writes the files finished since the last call, if progressive output
+    // was started, replacing their earlier output atomically. Only their
+    // links are evaluated with the shared lock held.
+    void writeFinishedFiles();
+
     // Not threadsafe!
     SymbolDeclaration const* findMissingDef(std::string const& usr)
     {
@@ -89,19 +182,102 @@ public:
         m_refLinker(m, mcur);
     }
 
+    // Accumulates the counters of a per-TU CursorCache.
+    void addCursorCacheStats(std::size_t lookups, std::size_t hits) noexcept
+    {
+        m_cursorCacheLookups += lookups;
+        m_cursorCacheHits += hits;
+    }
+
+    std::size_t cursorCacheLookups() const noexcept
+    {
+        return m_cursorCacheLookups;
+    }
+
+    std::size_t cursorCacheHits() const noexcept { return m_cursorCacheHits; }
+
+    // Not threadsafe!
+    void addMemoryStats(MemoryStats& stats) const;
+
+    // From now on, remember the files handed out by prepareToProcess(), the
+    // symbols returned by createSymbol() and the definitions passed to
+    // registerDef(), for writeRecordedResult().
+    // Used in forked worker processes. Not threadsafe!
+    void startRecording();
+
+    // Appends the recorded files (with their markups and disabled lines),
+    // definitions and the inclusions in the include graph (if set), together
+    // with the symbols they reference, to out. Links
+    // that are neither to symbols nor to definitions are evaluated and stored
+    // as URLs. The format is only meant for mergeResult() of a process running
+    // the same executable. Not threadsafe!
+    void writeRecordedResult(std::string& out);
+
+    // Adds a result written by writeRecordedResult() in another process.
+    // Files that were already processed are skipped. Throws
+    // std::runtime_error if data is truncated or malformed, without having
+    // merged anything.
+    void mergeResult(char const* data, std::size_t size);
+
+    // Writes all files (with their markups and disabled lines), symbols,
+    // definitions, the inclusions in the include graph (if set) and
+    // input/output directories to out in synth's index format, which
+    // writeOutput() can be run on after loadIndex(), without libclang.
+    // Not threadsafe!
+    void writeIndex(std::ostream& out);
+
+    // Loads an index written by writeIndex() into an object constructed with
+    // no directories. Can be called repeatedly to merge indexes with the same
+    // directories, e.g. of shards: As with prepareToProcess(), only the first
+    // index that processed a file is used for it, and the first definition of
+    // a USR is kept. Inclusions are added to the include graph, if one is set.
+    // Throws std::runtime_error if the index is malformed or of another
+    // version; the object is left unchanged in that case.
+    // Not threadsafe!
+    void loadIndex(char const* data, std::size_t size);
+
 private:
+    class SpillFile;
 
     using FileEntryMap = std::unordered_map<CXFileUniqueID, FileEntry>;
 
     // Returns nullptr if f should be ignored.
     FileEntry* obtainFileEntry(CXFile f);
+    FileEntry* obtainFileEntry(CXFileUniqueID const& fuid, fs::path fname);
+
+    // Also considers IDs of files reset by resetFiles(). m_mut must be locked.
+    FileEntry* findFileEntry(CXFileUniqueID const& fuid);
+
+    // Sets needsOutput for files linking to m_changedUsrs.
+    void markFilesLinkingToChangedDefs();
+
+    void finishFile(FileEntry& fentry);
+    void spillIfOverLimit(FileEntry& fentry);
+    void loadSpilled(FileEntry& fentry);
+    void writeFile(FileEntry& fentry, SimpleTemplate const& tpl);
+    // Adds the basic or lexical highlighting to hlFile and writes it.
+    // Does not need m_mut if hlFile's links do not access the state.
+    void renderFile(
+        HighlightedFile& hlFile, bool lexical, SimpleTemplate const& tpl);
+
+    // Locks m_mut, accounting the time waited in m_metrics.
+    std::unique_lock<std::mutex> lockShared();
 
     PathMap::value_type const* getFileMapping(fs::path const& p) const;
 
 
     FileEntryMap m_processedFiles;
+    std::unordered_map<fs::path, FileEntry*, boost::hash<fs::path>>
+        m_filesByPath;
     PathMap m_dirs;
 
+    // New IDs of files reset by resetFiles().
+    std::unordered_map<CXFileUniqueID, FileEntry*> m_fuidAliases;
+    std::vector<FileEntry*> m_resetFiles;
+
+    // USRs whose definition was reset since the last writeOutput().
+    std::unordered_set<std::string> m_changedUsrs;
+
     // Maps from USRs to symbol declarations (referencing m_syms)
     std::unordered_map<std::string, SymbolDeclaration const*> m_defs;
     SymbolMap m_syms;
@@ -113,6 +289,31 @@ private:
 
     std::size_t m_maxIdSz; // Maximum length for fileUniqueNames in m_syms.
 
+    Tracer* m_tracer = nullptr;
+    Metrics* m_metrics = nullptr;
+    IncludeGraph* m_includeGraph = nullptr;
+
+    std::atomic<std::size_t> m_cursorCacheLookups {0};
+    std::atomic<std::size_t> m_cursorCacheHits {0};
+
+    std::unique_ptr<SpillFile> m_spillFile;
+    std::size_t m_maxMarkupBytes = 0;
+    std::atomic<std::size_t> m_markupBytes {0}; // Not spilled ones.
+
+    // Set while writing progressively; finished files are queued in
+    // m_finishedFiles.
+    SimpleTemplate const* m_progressiveTpl = nullptr;
+    std::vector<FileEntry*> m_finishedFiles;
+
+    // Set by writeOutput(); see there.
+    fs::path m_rootOutDir;
+    bool m_commonOutRoot = false;
+
+    bool m_recording = false;
+    std::vector<FileEntry*> m_recordedFiles;
+    std::unordered_map<SymbolDeclaration const*, SymbolId> m_recordedSyms;
+    std::vector<std::pair<std::string, SymbolDeclaration const*>>
+        m_recordedDefs;
 
     std::mutex m_mut;
 };
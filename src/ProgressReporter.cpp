@@ -0,0 +1,128 @@
+#include "ProgressReporter.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+using namespace synth;
+
+// A line is printed at most every kMinInterval if TUs were finished since
+// the last one and otherwise every kMaxInterval, to still show stuck TUs.
+static auto const kMinInterval = std::chrono::seconds(1);
+static auto const kMaxInterval = std::chrono::seconds(10);
+static std::size_t const kMaxListedInFlight = 4;
+
+static void writeDuration(std::ostream& out, double seconds)
+{
+    auto s = static_cast<unsigned long>(seconds + 0.5);
+    if (s >= 3600)
+        out << s / 3600 << 'h';
+    if (s >= 60)
+        out << s / 60 % 60 << 'm';
+    out << s % 60 << 's';
+}
+
+ProgressReporter::ProgressReporter(
+    unsigned nTus, unsigned nSlots, NameFn&& nameOf, std::ostream& out)
+    : m_nTus(nTus)
+    , m_nSlots(nSlots)
+    , m_nameOf(std::move(nameOf))
+    , m_out(out)
+    , m_start(Clock::now())
+    , m_slots(new Slot[nSlots])
+{
+    m_thread = std::thread(&ProgressReporter::run, this);
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    stop();
+}
+
+void ProgressReporter::stop()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mut);
+        m_stop = true;
+    }
+    m_stopRequested.notify_one();
+    m_thread.join();
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - m_start)
+        .count();
+    m_out << "Processed " << m_nDone << " of " << m_nTus << " TUs in ";
+    writeDuration(m_out, elapsed);
+    m_out << ".\n";
+}
+
+void ProgressReporter::run()
+{
+    unsigned lastDone = 0;
+    Clock::time_point lastWrite = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mut);
+    while (!m_stopRequested.wait_for(
+        lock, kMinInterval, [this] { return m_stop; })
+    ) {
+        Clock::time_point now = Clock::now();
+        unsigned nDone = m_nDone.load(std::memory_order_relaxed);
+        if (nDone == lastDone && now - lastWrite < kMaxInterval)
+            continue;
+        lastDone = nDone;
+        lastWrite = now;
+        lock.unlock();
+        writeStatus(now);
+        lock.lock();
+    }
+}
+
+void ProgressReporter::writeStatus(Clock::time_point now)
+{
+    unsigned nDone = m_nDone.load(std::memory_order_relaxed);
+    unsigned nTus = m_nTus.load(std::memory_order_relaxed);
+    double elapsed = std::chrono::duration<double>(now - m_start).count();
+
+    // first: seconds in flight.
+    std::vector<std::pair<double, unsigned>> inFlight;
+    for (unsigned i = 0; i < m_nSlots; ++i) {
+        unsigned tuIdx = m_slots[i].tuIdx.load(std::memory_order_acquire);
+        if (tuIdx == UINT_MAX)
+            continue;
+        Clock::time_point started(Clock::duration(
+            m_slots[i].startTicks.load(std::memory_order_relaxed)));
+        inFlight.push_back({
+            std::chrono::duration<double>(now - started).count(), tuIdx});
+    }
+    std::sort(inFlight.rbegin(), inFlight.rend()); // Longest first.
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2);
+    line << '[' << std::setw(6)
+         << (nTus == 0 ? 100.0 : 100.0 * nDone / nTus) << "%] "
+         << nDone << '/' << nTus << " TUs";
+    if (nDone != 0 && elapsed > 0) {
+        double rate = nDone / elapsed;
+        line << ", " << rate << " TU/s, ETA ";
+        writeDuration(line, (nTus - nDone) / rate);
+    }
+    if (!inFlight.empty()) {
+        line << "; in flight: ";
+        line << std::setprecision(1);
+        for (std::size_t i = 0; i < inFlight.size(); ++i) {
+            if (i == kMaxListedInFlight) {
+                line << ", " << inFlight.size() - i << " more";
+                break;
+            }
+            if (i != 0)
+                line << ", ";
+            line << m_nameOf(inFlight[i].second)
+                 << " (" << inFlight[i].first << "s)";
+        }
+    }
+    line << '\n';
+    m_out << line.str() << std::flush;
+}
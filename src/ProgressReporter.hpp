@@ -0,0 +1,90 @@
+#ifndef SYNTH_PROGRESSREPORTER_HPP_INCLUDED
+#define SYNTH_PROGRESSREPORTER_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace synth {
+
+// Periodically prints a status line with the number of finished translation
+// units, an ETA based on the throughput so far and the TUs currently being
+// processed, from a background thread.
+// Workers report through begin() and end(), which only store to atomics, so
+// they never wait for the reporter or each other.
+class ProgressReporter {
+public:
+    using NameFn = std::function<std::string(unsigned tuIdx)>;
+
+    // nameOf is called from the reporter thread.
+    ProgressReporter(
+        unsigned nTus, unsigned nSlots, NameFn&& nameOf, std::ostream& out);
+    ~ProgressReporter();
+
+    ProgressReporter(ProgressReporter const&) = delete;
+    ProgressReporter& operator= (ProgressReporter const&) = delete;
+
+    // Each thread must use its own slot in [0, nSlots).
+    void begin(unsigned slot, unsigned tuIdx) noexcept
+    {
+        Slot& s = m_slots[slot];
+        s.startTicks.store(
+            Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        s.tuIdx.store(tuIdx, std::memory_order_release);
+    }
+
+    void end(unsigned slot) noexcept
+    {
+        m_slots[slot].tuIdx.store(UINT_MAX, std::memory_order_relaxed);
+        m_nDone.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // For when not all TUs are known in advance.
+    void addTus(unsigned n) noexcept
+    {
+        m_nTus.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Stops the reporter thread and prints a summary.
+    void stop();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        std::atomic<Clock::rep> startTicks {0};
+        std::atomic<unsigned> tuIdx {UINT_MAX}; // UINT_MAX: Idle.
+
+        // Avoid false sharing. alignas would require C++17 aligned new.
+        char padding[64
+            - sizeof(std::atomic<Clock::rep>)
+            - sizeof(std::atomic<unsigned>)];
+    };
+
+    void run();
+    void writeStatus(Clock::time_point now);
+
+    std::atomic<unsigned> m_nTus;
+    unsigned const m_nSlots;
+    NameFn const m_nameOf;
+    std::ostream& m_out;
+    Clock::time_point const m_start;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<unsigned> m_nDone {0};
+
+    bool m_stop = false;
+    std::mutex m_mut; // Only for m_stop.
+    std::condition_variable m_stopRequested;
+    std::thread m_thread;
+};
+
+} // namespace synth
+
+#endif // SYNTH_PROGRESSREPORTER_HPP_INCLUDED
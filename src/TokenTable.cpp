@@ -0,0 +1,30 @@
+#include "TokenTable.hpp"
+
+#include <cassert>
+
+using namespace synth;
+
+void TokenTable::assign(
+    CXTranslationUnit tu, CXToken* tokens, unsigned ntokens)
+{
+    cursors.resize(ntokens);
+    clang_annotateTokens(tu, tokens, ntokens, cursors.data());
+
+    beginOffsets.resize(ntokens);
+    endOffsets.resize(ntokens);
+    lines.resize(ntokens);
+    kinds.resize(ntokens);
+    for (unsigned i = 0; i < ntokens; ++i) {
+        CXSourceRange rng = clang_getTokenExtent(tu, tokens[i]);
+        clang_getFileLocation(
+            clang_getRangeStart(rng),
+            nullptr,
+            &lines[i],
+            nullptr,
+            &beginOffsets[i]);
+        clang_getFileLocation(
+            clang_getRangeEnd(rng), nullptr, nullptr, nullptr, &endOffsets[i]);
+        kinds[i] = clang_getTokenKind(tokens[i]);
+        assert(i == 0 || beginOffsets[i - 1] < beginOffsets[i]);
+    }
+}
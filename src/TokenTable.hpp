@@ -0,0 +1,44 @@
+#ifndef SYNTH_TOKENTABLE_HPP_INCLUDED
+#define SYNTH_TOKENTABLE_HPP_INCLUDED
+
+#include <clang-c/Index.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace synth {
+
+// The tokens of a single file, stored as structure of arrays. All vectors are
+// indexed like the tokens returned by clang_tokenize(). This is filled once
+// per file so that later stages do not have to query libclang for each token
+// again.
+struct TokenTable {
+    std::vector<unsigned> beginOffsets; // Sorted, see find().
+    std::vector<unsigned> endOffsets;
+    std::vector<unsigned> lines; // Line of the beginning of the token.
+    std::vector<CXTokenKind> kinds;
+    std::vector<CXCursor> cursors; // As returned by clang_annotateTokens().
+
+    // Annotates the tokens and fills all columns.
+    void assign(CXTranslationUnit tu, CXToken* tokens, unsigned ntokens);
+
+    std::size_t size() const { return beginOffsets.size(); }
+
+    // Returns the index of the token starting at off or SIZE_MAX if there is
+    // no such token. Since clang_tokenize() returns the tokens in source
+    // order, beginOffsets can be binary searched.
+    std::size_t find(unsigned off) const
+    {
+        auto it = std::lower_bound(
+            beginOffsets.begin(), beginOffsets.end(), off);
+        if (it == beginOffsets.end() || *it != off)
+            return SIZE_MAX;
+        return static_cast<std::size_t>(it - beginOffsets.begin());
+    }
+};
+
+} // namespace synth
+
+#endif // SYNTH_TOKENTABLE_HPP_INCLUDED
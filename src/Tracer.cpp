@@ -0,0 +1,110 @@
+#include "Tracer.hpp"
+
+#include <boost/io/ios_state.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+using namespace synth;
+
+static void writeJsonString(std::string& out, boost::string_ref s)
+{
+    static char const kHexDigits[] = "0123456789abcdef";
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += kHexDigits[(c >> 4) & 0xf];
+                    out += kHexDigits[c & 0xf];
+                } else {
+                    out += c;
+                }
+                break;
+        }
+    }
+    out += '"';
+}
+
+Tracer::Tracer(bool keepEvents)
+    : m_start(Clock::now())
+    , m_keepEvents(keepEvents)
+{ }
+
+void Tracer::record(
+    char const* name,
+    Clock::time_point begin,
+    Clock::time_point end,
+    std::string&& args)
+{
+    using Us = std::chrono::duration<double, std::micro>;
+    Event ev {
+        name,
+        Us(begin - m_start).count(),
+        Us(end - begin).count(),
+        0,
+        std::move(args)};
+    std::lock_guard<std::mutex> lock(m_mut);
+    auto total = std::find_if(
+        m_totals.begin(), m_totals.end(),
+        [name](PhaseTotal const& t) { return !std::strcmp(t.name, name); });
+    if (total == m_totals.end())
+        total = m_totals.insert(total, {name, 0, 0});
+    total->seconds += ev.durationUs / 1e6;
+    ++total->count;
+    if (!m_keepEvents)
+        return;
+    ev.tid = m_tids.insert({
+            std::this_thread::get_id(),
+            static_cast<unsigned>(m_tids.size())})
+        .first->second;
+    m_events.push_back(std::move(ev));
+}
+
+void Tracer::writeTo(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(m_mut);
+    boost::io::ios_flags_saver flagsSaver(out);
+    boost::io::ios_precision_saver precisionSaver(out);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    std::string name;
+    for (Event const& ev : m_events) {
+        if (!first)
+            out << ',';
+        first = false;
+        name.clear();
+        writeJsonString(name, ev.name);
+        out << "\n{\"name\":" << name
+            << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ev.tid
+            << ",\"ts\":" << ev.beginUs
+            << ",\"dur\":" << ev.durationUs
+            << ",\"args\":{" << ev.args << "}}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+std::vector<Tracer::PhaseTotal> Tracer::phaseTotals() const
+{
+    std::lock_guard<std::mutex> lock(m_mut);
+    return m_totals;
+}
+
+void TraceSpan::addArg(boost::string_ref key, boost::string_ref value)
+{
+    if (!enabled())
+        return;
+    if (!m_args.empty())
+        m_args += ',';
+    writeJsonString(m_args, key);
+    m_args += ':';
+    writeJsonString(m_args, value);
+}
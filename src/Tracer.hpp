@@ -0,0 +1,101 @@
+#ifndef SYNTH_TRACER_HPP_INCLUDED
+#define SYNTH_TRACER_HPP_INCLUDED
+
+#include <boost/utility/string_ref.hpp>
+
+#include <chrono>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace synth {
+
+// Records timed spans and writes them in the Chrome trace_event JSON format
+// (load the file in chrome://tracing or https://ui.perfetto.dev). Also sums up
+// the duration of all spans with the same name.
+// All member functions are threadsafe.
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct PhaseTotal {
+        char const* name;
+        double seconds;
+        std::size_t count;
+    };
+
+    // If keepEvents is false, only the totals are maintained and writeTo()
+    // writes no events.
+    explicit Tracer(bool keepEvents = true);
+
+    // args must be empty or a comma separated list of JSON "key": value pairs.
+    void record(
+        char const* name,
+        Clock::time_point begin,
+        Clock::time_point end,
+        std::string&& args);
+
+    void writeTo(std::ostream& out) const;
+
+    std::vector<PhaseTotal> phaseTotals() const;
+
+    bool keepsEvents() const { return m_keepEvents; }
+
+private:
+    struct Event {
+        char const* name; // Must be a string literal.
+        double beginUs;
+        double durationUs;
+        unsigned tid;
+        std::string args;
+    };
+
+    Clock::time_point m_start;
+    bool m_keepEvents;
+    std::vector<Event> m_events;
+    std::vector<PhaseTotal> m_totals; // Few enough for linear search.
+    std::unordered_map<std::thread::id, unsigned> m_tids;
+    mutable std::mutex m_mut;
+};
+
+// Records the time from its construction until its destruction as a span.
+// If constructed with a null Tracer, it does nothing, so that instrumentation
+// costs about one branch when tracing is disabled.
+class TraceSpan {
+public:
+    TraceSpan(Tracer* tracer, char const* name)
+        : m_tracer(tracer)
+        , m_name(name)
+    {
+        if (m_tracer)
+            m_begin = Tracer::Clock::now();
+    }
+
+    TraceSpan(TraceSpan const&) = delete;
+    TraceSpan& operator= (TraceSpan const&) = delete;
+
+    ~TraceSpan()
+    {
+        if (m_tracer)
+            m_tracer->record(
+                m_name, m_begin, Tracer::Clock::now(), std::move(m_args));
+    }
+
+    // Check this before computing expensive arguments.
+    bool enabled() const { return m_tracer && m_tracer->keepsEvents(); }
+
+    void addArg(boost::string_ref key, boost::string_ref value);
+
+private:
+    Tracer* m_tracer;
+    char const* m_name;
+    Tracer::Clock::time_point m_begin;
+    std::string m_args;
+};
+
+} // namespace synth
+
+#endif // SYNTH_TRACER_HPP_INCLUDED
@@ -1,20 +1,34 @@
 #include "annotate.hpp"
 
 #include "CgStr.hpp"
+#include "CursorCache.hpp"
+#include "Metrics.hpp"
 #include "MultiTuProcessor.hpp"
+#include "TokenTable.hpp"
+#include "Tracer.hpp"
 #include "cgWrappers.hpp"
 #include "FileIdSupport.hpp"
+#include "IncludeGraph.hpp"
 #include "highlight.hpp"
 #include "output.hpp"
 #include "xref.hpp"
 
 #include <boost/assert.hpp>
 
+#include <algorithm>
 #include <climits>
+#include <cstdint>
 #include <iostream>
 
 using namespace synth;
 
+// clang_getFileContents() is new in libclang 6.0.
+#if CINDEX_VERSION >= CINDEX_VERSION_ENCODE(0, 45)
+#   define SYNTH_HAS_FILE_CONTENTS 1
+#else
+#   define SYNTH_HAS_FILE_CONTENTS 0
+#endif
+
 // This is needed for macro arguments: clang_equalLocations is only true if two
 // locations are truly equal. That is if either of spelling-, source- or
 // file-location is different, it returns false. However we are only interested
@@ -22,16 +36,15 @@ using namespace synth;
 // We must work with the offset here because it is in fact often different (and
 // more "correct" for our purposes) from what line:column would suggest. See
 // also comment inside processToken().
-static bool equalFileLocations(CXSourceLocation loc1, CXSourceLocation loc2)
+// The second location is given as file and offset since that is what we have
+// in the TokenTable.
+static bool equalFileLocations(
+    CXSourceLocation loc1, CXFile f2, unsigned off2)
 {
     CXFile f1;
     unsigned off1;
     clang_getFileLocation(loc1, &f1, nullptr, nullptr, &off1);
 
-    CXFile f2;
-    unsigned off2;
-    clang_getFileLocation(loc2, &f2, nullptr, nullptr, &off2);
-
     return off1 == off2 && clang_File_isEqual(f1, f2);
 }
 
@@ -47,20 +60,28 @@ namespace {
 struct FileAnnotationState {
     CXFile file;
     HighlightedFile& hlFile;
-    CgTokensHandle tokens;
-    std::vector<CXCursor> annotations;
+#if SYNTH_HAS_FILE_CONTENTS
+    boost::string_ref contents; // Owned by the translation unit.
+#else
+    CgTokensHandle tokens; // For clang_getTokenSpelling().
+#endif
+    TokenTable tokTable; // The cursors column holds the fixed annotations.
     std::vector<bool> annotationBad;
 
-    // Maps from token begin offsets to indices (in tokens and tokCurs).
-    std::unordered_map<unsigned, std::size_t> locationMap;
+    // Locations of the #include directives through which file was included,
+    // innermost first (see clang_getInclusions()).
+    std::vector<CXSourceLocation> inclusionStack;
+
+    // Sorted offsets at which annotate() has to look: Those of bad tokens and
+    // those of #include directives that lead to a file with bad tokens.
+    std::vector<unsigned> visitOffsets;
 
-    void populateLocationMap(CXTranslationUnit tu)
+    // Returns true if any of visitOffsets is inside [beginOff, endOff].
+    bool needsVisit(unsigned beginOff, unsigned endOff) const
     {
-        for (std::size_t i = 0; i < tokens.size(); ++i) {
-            CXToken tok = tokens.tokens()[i];
-            unsigned off = getLocOffset(clang_getTokenLocation(tu, tok));
-            BOOST_VERIFY(locationMap.insert({off, i}).second);
-        }
+        auto it = std::lower_bound(
+            visitOffsets.begin(), visitOffsets.end(), beginOff);
+        return it != visitOffsets.end() && *it <= endOff;
     }
 };
 
@@ -71,6 +92,10 @@ struct TuState {
     CXTranslationUnit tu;
     MultiTuProcessor& multiTuProcessor;
     bool isC;
+    CursorCache cursorCache;
+    std::chrono::steady_clock::time_point deadline;
+    bool timedOut;
+    unsigned nVisited; // Used to only check the deadline occasionally.
 };
 
 struct FileState {
@@ -90,33 +115,46 @@ static FileAnnotationState* lookupFileAnnotations(TuAnnotationMap& m, CXFile f)
     return it == m.end() ? nullptr : &it->second;
 }
 
-static void processToken(FileState& state, CXToken tok, CXCursor cur)
+static void processToken(
+    FileState& state,
+    FileAnnotationState& fAnnotations,
+    std::size_t tokIdx)
 {
+    TokenTable const& toks = fAnnotations.tokTable;
+    if (toks.beginOffsets[tokIdx] == toks.endOffsets[tokIdx])
+        return;
+
     auto& markups = state.hlFile.markups;
     markups.emplace_back();
     Markup* m = &markups.back();
-    CXTranslationUnit tu = clang_Cursor_getTranslationUnit(cur);
-    CXSourceRange rng = clang_getTokenExtent(tu, tok);
-    unsigned lineno;
-    clang_getFileLocation(
-        clang_getRangeStart(rng), nullptr, &lineno, nullptr, &m->beginOffset);
-    m->endOffset = getLocOffset(clang_getRangeEnd(rng));
-    if (m->beginOffset == m->endOffset) {
-        markups.pop_back();
-        return;
-    }
-
-    CgStr hsp(clang_getTokenSpelling(tu, tok));
+    m->beginOffset = toks.beginOffsets[tokIdx];
+    m->endOffset = toks.endOffsets[tokIdx];
+    unsigned lineno = toks.lines[tokIdx];
+    CXCursor cur = toks.cursors[tokIdx];
+    CXTokenKind tk = toks.kinds[tokIdx];
+
+#if SYNTH_HAS_FILE_CONTENTS
+    // Slicing the file contents avoids allocating a CXString for each token.
+    boost::string_ref sp = fAnnotations.contents.substr(
+        m->beginOffset, m->endOffset - m->beginOffset);
+#else
+    CgStr hsp(clang_getTokenSpelling(
+        state.tuState.tu, fAnnotations.tokens.tokens()[tokIdx]));
     boost::string_ref sp = hsp.gets();
-    m->attrs = getTokenAttributes(tok, cur, sp);
+#endif
+    m->attrs = getTokenAttributes(tk, cur, sp, state.tuState.cursorCache);
 
-    CXTokenKind tk = clang_getTokenKind(tok);
     if (tk == CXToken_Comment || tk == CXToken_Literal)
         return;
 
     CXCursorKind k = clang_getCursorKind(cur);
+    if (clang_isInvalid(k)) // E.g. a top-level ";": Nothing to link.
+        return;
+
+    SpellingClass spCls = classifySpelling(sp);
+
     if (state.lnkPending) {
-        if (tk == CXToken_Punctuation && (sp == "(" || sp == "[")) {
+        if (tk == CXToken_Punctuation && spCls == SpellingClass::openParen) {
             // This is the "("/"[" of an operator overload and we also want
             // to highlight the closing ")"/"]".
             return;
@@ -130,7 +168,7 @@ static void processToken(FileState& state, CXToken tok, CXCursor cur)
         markups.push_back(std::move(lnk));
         m = &markups.back();
     } else if (!equalFileLocations(
-        clang_getRangeStart(rng), clang_getCursorLocation(cur))
+        clang_getCursorLocation(cur), fAnnotations.file, m->beginOffset)
     ) {
         // Note that there is magic in the offset with which equalFileLocations
         // works (and clang_equalLocations too); it is sometimes different from
@@ -145,7 +183,11 @@ static void processToken(FileState& state, CXToken tok, CXCursor cur)
         CXSourceRange incrng = clang_getCursorExtent(cur);
         incLnk.beginOffset = getLocOffset(clang_getRangeStart(incrng));
         incLnk.endOffset = getLocOffset(clang_getRangeEnd(incrng));
-        linkCursor(incLnk, cur, state.tuState.multiTuProcessor);
+        linkCursor(
+            incLnk,
+            cur,
+            state.tuState.multiTuProcessor,
+            state.tuState.cursorCache);
         if (incLnk.isRef())
             state.hlFile.markups.push_back(std::move(incLnk));
         return;
@@ -155,7 +197,7 @@ static void processToken(FileState& state, CXToken tok, CXCursor cur)
         return;
     } else if (tk == CXToken_Keyword
         && (k == CXCursor_FunctionDecl || k == CXCursor_CXXMethod)
-        && sp == "operator"
+        && spCls == SpellingClass::kwOperator
     ) {
         state.lnkPending = true;
         return;
@@ -166,26 +208,26 @@ static void processToken(FileState& state, CXToken tok, CXCursor cur)
     // where both the "using" and the "Foo" were independenty linked.
     // "{" was highlighted as definition for anonymous namespaces.
     if (tk != CXToken_Keyword
-        && (tk != CXToken_Punctuation || (sp != "{" && sp != ";"))
+        && (tk != CXToken_Punctuation || spCls != SpellingClass::declPunct)
     ) {
         SymbolDeclaration* decl = nullptr;
         auto const loadDecl = [&]() {
             if (decl)
                 return;
-            decl = &state.tuState.multiTuProcessor.createSymbol(
-                state.hlFile,
-                lineno,
-                m->beginOffset);
-
-            assert(decl->fileUniqueName.empty());
+            std::string name;
             std::size_t maxIdSz = state.tuState.multiTuProcessor.maxIdSz();
             if (maxIdSz > 0) {
-                std::string name = fileUniqueName(cur, state.tuState.isC);
-                if (name.size() < maxIdSz) {
-                    decl->fileUniqueName = std::move(name);
-                    m->fileUniqueName = &decl->fileUniqueName;
-                }
+                name = fileUniqueName(cur, state.tuState.isC);
+                if (name.size() >= maxIdSz)
+                    name.clear();
             }
+            decl = &state.tuState.multiTuProcessor.createSymbol(
+                state.hlFile,
+                lineno,
+                m->beginOffset,
+                std::move(name));
+            if (!decl->fileUniqueName.empty())
+                m->fileUniqueName = &decl->fileUniqueName;
         };
 
         if (clang_isDeclaration(k)) {
@@ -193,24 +235,36 @@ static void processToken(FileState& state, CXToken tok, CXCursor cur)
             loadDecl();
         }
 
-        CXCursor defcur = clang_getCursorDefinition(cur);
+        CXCursor defcur = state.tuState.cursorCache.definition(cur);
         if (clang_equalCursors(defcur, cur)) { // This is a definition:
             m->attrs |= TokenAttributes::flagDef;
             loadDecl();
-            CgStr usr(clang_getCursorUSR(cur));
-            if (!usr.empty())
-                state.tuState.multiTuProcessor.registerDef(usr.get(), decl);
+            std::string const& usr = state.tuState.cursorCache.usr(cur);
+            if (!usr.empty()) {
+                state.tuState.multiTuProcessor.registerDef(
+                    std::string(usr), decl);
+            }
         }
     }
 
     assert(m->beginOffset < m->endOffset);
-    linkCursor(*m, cur, state.tuState.multiTuProcessor);
+    linkCursor(
+        *m, cur, state.tuState.multiTuProcessor, state.tuState.cursorCache);
+}
+
+static bool deadlinePassed(TuState& state)
+{
+    if (!state.timedOut)
+        state.timedOut = std::chrono::steady_clock::now() > state.deadline;
+    return state.timedOut;
 }
 
 static CXChildVisitResult annotateVisit(
     CXCursor c, CXCursor, CXClientData ud)
 {
     auto& state = *static_cast<TuState*>(ud);
+    if ((++state.nVisited & 0xff) == 0 && deadlinePassed(state))
+        return CXChildVisit_Break;
     if (state.isC) {
         CXLanguageKind lang = clang_getCursorLanguage(c);
         state.isC = lang == CXLanguage_C || lang == CXLanguage_Invalid;
@@ -223,31 +277,116 @@ static CXChildVisitResult annotateVisit(
     if (!astate)
         return ln == 0 ? CXChildVisit_Recurse : CXChildVisit_Continue;
 
-    auto itIdx = astate->locationMap.find(off);
-    if (itIdx == astate->locationMap.end()
-        || !astate->annotationBad[itIdx->second]
+    std::size_t idx = astate->tokTable.find(off);
+    if (idx != SIZE_MAX && astate->annotationBad[idx])
+        astate->tokTable.cursors[idx] = c;
+
+    // As long as isC is undecided, we must look at every cursor.
+    if (state.isC)
+        return CXChildVisit_Recurse;
+
+    CXSourceRange rng = clang_getCursorExtent(c);
+    CXFile begF, endF;
+    unsigned begOff, endOff;
+    clang_getFileLocation(
+        clang_getRangeStart(rng), &begF, nullptr, nullptr, &begOff);
+    clang_getFileLocation(
+        clang_getRangeEnd(rng), &endF, nullptr, nullptr, &endOff);
+    if (!clang_File_isEqual(begF, astate->file)
+        || !clang_File_isEqual(endF, astate->file)
+        || astate->needsVisit(begOff, endOff)
     ) {
         return CXChildVisit_Recurse;
     }
+    return CXChildVisit_Continue;
+}
 
-    CXCursor& acur = astate->annotations[itIdx->second];
-    acur = c;
+static CXChildVisitResult detectLanguageVisit(
+    CXCursor c, CXCursor, CXClientData ud)
+{
+    auto& state = *static_cast<TuState*>(ud);
+    CXLanguageKind lang = clang_getCursorLanguage(c);
+    state.isC = lang == CXLanguage_C || lang == CXLanguage_Invalid;
+    if (!state.isC)
+        return CXChildVisit_Break;
+    CXFile f;
+    unsigned ln;
+    clang_getFileLocation(
+        clang_getCursorLocation(c), &f, &ln, nullptr, nullptr);
+    if (ln != 0 && !lookupFileAnnotations(state.annotationMap, f))
+        return CXChildVisit_Continue;
     return CXChildVisit_Recurse;
 }
 
+// Fills visitOffsets of all files and returns true if any of them is nonempty.
+static bool collectVisitOffsets(TuState& state)
+{
+    bool anyBad = false;
+    for (auto& fAnnotationsEntry : state.annotationMap) {
+        FileAnnotationState& fAnnotations = fAnnotationsEntry.second;
+        bool fileHasBad = false;
+        for (std::size_t i = 0; i < fAnnotations.annotationBad.size(); ++i) {
+            if (fAnnotations.annotationBad[i]) {
+                fAnnotations.visitOffsets.push_back(
+                    fAnnotations.tokTable.beginOffsets[i]);
+                fileHasBad = true;
+            }
+        }
+        if (!fileHasBad)
+            continue;
+        anyBad = true;
+        for (CXSourceLocation incLoc : fAnnotations.inclusionStack) {
+            CXFile f;
+            unsigned off;
+            clang_getFileLocation(incLoc, &f, nullptr, nullptr, &off);
+            FileAnnotationState* includer = lookupFileAnnotations(
+                state.annotationMap, f);
+            if (includer)
+                includer->visitOffsets.push_back(off);
+        }
+    }
+    for (auto& fAnnotationsEntry : state.annotationMap) {
+        auto& offs = fAnnotationsEntry.second.visitOffsets;
+        std::sort(offs.begin(), offs.end());
+    }
+    return anyBad;
+}
+
+// Tries to repair the bad annotations by walking the AST. Only subtrees that
+// can contain cursors at visitOffsets are visited. The walk is also used to
+// determine state.isC; if there are no bad annotations, the AST is only
+// walked until a non-C declaration is found.
 static void annotate(TuState& state, CXCursor root)
 {
-    clang_visitChildren(root, &annotateVisit, &state);
+    TraceSpan span(state.multiTuProcessor.tracer(), "annotate");
+    if (collectVisitOffsets(state))
+        clang_visitChildren(root, &annotateVisit, &state);
+    else
+        clang_visitChildren(root, &detectLanguageVisit, &state);
 }
 
 static void processFile(
-    CXFile file, CXSourceLocation*, unsigned, CXClientData ud)
+    CXFile file,
+    CXSourceLocation* inclusionStack,
+    unsigned inclusionDepth,
+    CXClientData ud)
 {
     CXFileUniqueID fuid;
     if (clang_getFileUniqueID(file, &fuid) != 0)
         return;
 
     auto& state = *static_cast<TuState*>(ud);
+    IncludeGraph* includeGraph = state.multiTuProcessor.includeGraph();
+    if (includeGraph && inclusionDepth > 0) {
+        CXFile includer;
+        clang_getFileLocation(
+            inclusionStack[0], &includer, nullptr, nullptr, nullptr);
+        includeGraph->addInclusion(
+            CgStr(clang_getFileName(file)).gets(),
+            CgStr(clang_getFileName(includer)).gets());
+    }
+    if (deadlinePassed(state))
+        return;
     CXTranslationUnit tu = state.tu;
 
     CXSourceLocation beg = clang_getLocationForOffset(tu, file, 0);
@@ -257,6 +396,17 @@ static void processFile(
     if (!hlFile)
         return;
 
+    TraceSpan span(state.multiTuProcessor.tracer(), "processFile");
+    if (span.enabled())
+        span.addArg("file", CgStr(clang_getFileName(file)).gets());
+
+#if SYNTH_HAS_FILE_CONTENTS
+    std::size_t contentsSz;
+    char const* contents = clang_getFileContents(tu, file, &contentsSz);
+    if (!contents)
+        return;
+#endif
+
     CXToken* tokens;
     unsigned numTokens;
     clang_tokenize(tu, clang_getRange(beg, end), &tokens, &numTokens);
@@ -264,18 +414,25 @@ static void processFile(
 
     if (numTokens == 0)
         return;
+    if (Metrics* metrics = state.multiTuProcessor.metrics())
+        metrics->tokens += numTokens;
 
-    std::vector<CXCursor> annotations(numTokens);
-    clang_annotateTokens(tu, tokens, numTokens, annotations.data());
+    TokenTable tokTable;
+    {
+        TraceSpan annotateSpan(
+            state.multiTuProcessor.tracer(), "clang_annotateTokens");
+        tokTable.assign(tu, tokens, numTokens);
+    }
     std::vector<bool> annotationBad(numTokens);
 
     for (std::size_t i = 0; i < numTokens; ++i) {
-        CXCursor& cur = annotations[i];
-        CXSourceLocation tokLoc = clang_getTokenLocation(tu, tokens[i]);
-        if (!equalFileLocations(clang_getCursorLocation(cur), tokLoc)) {
-            CXCursor c2 = clang_getCursor(tu, tokLoc);
+        CXCursor& cur = tokTable.cursors[i];
+        unsigned tokOff = tokTable.beginOffsets[i];
+        if (!equalFileLocations(clang_getCursorLocation(cur), file, tokOff)) {
+            CXCursor c2 = clang_getCursor(
+                tu, clang_getLocationForOffset(tu, file, tokOff));
             CXSourceLocation loc2 = clang_getCursorLocation(c2);
-            if (equalFileLocations(loc2, tokLoc))
+            if (equalFileLocations(loc2, file, tokOff))
                 cur = c2;
             else
                 annotationBad[i] = true;
@@ -305,49 +462,108 @@ static void processFile(
     FileAnnotationState fstate {
         std::move(file),
         *hlFile,
+#if SYNTH_HAS_FILE_CONTENTS
+        boost::string_ref(contents, contentsSz),
+#else
         std::move(hToks),
-        std::move(annotations),
+#endif
+        std::move(tokTable),
         std::move(annotationBad),
-        std::unordered_map<unsigned, std::size_t>()
+        std::vector<CXSourceLocation>(
+            inclusionStack, inclusionStack + inclusionDepth),
+        std::vector<unsigned>()
     };
     auto kv = std::make_pair(std::move(fuid), std::move(fstate));
-    auto insRes = state.annotationMap.insert(std::move(kv));
-    assert(insRes.second);
-    insRes.first->second.populateLocationMap(tu);
-
+    BOOST_VERIFY(state.annotationMap.insert(std::move(kv)).second);
 }
 
 static void writeHlTokens(TuState& state)
 {
+    TraceSpan span(state.multiTuProcessor.tracer(), "writeHlTokens");
     for (auto& fAnnotationsEntry : state.annotationMap) {
         FileAnnotationState& fAnnotations = fAnnotationsEntry.second;
         FileState fstate {state, fAnnotations.hlFile, /*lnkPending=*/false};
-        for (std::size_t i = 0; i < fAnnotations.tokens.size(); ++i) {
-            CXToken tok = fAnnotations.tokens.tokens()[i];
-            CXCursor cur = fAnnotations.annotations[i];
-            processToken(fstate, tok, cur);
-        }
+        for (std::size_t i = 0; i < fAnnotations.tokTable.size(); ++i)
+            processToken(fstate, fAnnotations, i);
         fAnnotations.hlFile.markups.shrink_to_fit();
+        state.multiTuProcessor.finishFile(fAnnotations.file);
     }
 }
 
-int synth::processTu(
+namespace {
+
+struct InclusionScanState {
+    MultiTuProcessor& multiTuProcessor;
+    bool foundNew;
+};
+
+} // anonymous namespace
+
+static void scanFile(CXFile file, CXSourceLocation*, unsigned, CXClientData ud)
+{
+    auto& state = *static_cast<InclusionScanState*>(ud);
+    if (!state.foundNew && state.multiTuProcessor.needsProcessing(file))
+        state.foundNew = true;
+}
+
+// Returns true if the translation unit includes a file that still needs
+// processing, or if that cannot be determined cheaply.
+static bool includesNewFiles(
     CXIndex cidx,
     MultiTuProcessor& multiTuProcessor,
     char const* const* args,
     int nargs)
 {
+    TraceSpan span(multiTuProcessor.tracer(), "scanInclusions");
     CXTranslationUnit tu = nullptr;
     CXErrorCode err = clang_parseTranslationUnit2FullArgv(
         cidx,
-        /*source_filename:*/ nullptr, // Included in commandline.
+        /*source_filename:*/ nullptr,
         args,
         nargs,
         /*unsaved_files:*/ nullptr,
         /*num_unsaved_files:*/ 0,
-        CXTranslationUnit_DetailedPreprocessingRecord,
+        CXTranslationUnit_SkipFunctionBodies | CXTranslationUnit_Incomplete,
         &tu);
     CgTuHandle htu(tu);
+    if (err != CXError_Success)
+        return true; // Leave reporting the error to the real parse.
+    InclusionScanState state {multiTuProcessor, /*foundNew=*/ false};
+    clang_getInclusions(tu, &scanFile, &state);
+    return state.foundNew;
+}
+
+int synth::processTu(
+    CXIndex cidx,
+    MultiTuProcessor& multiTuProcessor,
+    char const* const* args,
+    int nargs,
+    ProcessTuOptions const& opts)
+{
+    Tracer* tracer = multiTuProcessor.tracer();
+    TraceSpan tuSpan(tracer, "processTu");
+    if (opts.scanFirst
+        && !includesNewFiles(cidx, multiTuProcessor, args, nargs)
+    ) {
+        return kTuNothingNew;
+    }
+    CXTranslationUnit tu = nullptr;
+    CXErrorCode err;
+    {
+        TraceSpan parseSpan(tracer, "parse");
+        err = clang_parseTranslationUnit2FullArgv(
+            cidx,
+            /*source_filename:*/ nullptr, // Included in commandline.
+            args,
+            nargs,
+            /*unsaved_files:*/ nullptr,
+            /*num_unsaved_files:*/ 0,
+            CXTranslationUnit_DetailedPreprocessingRecord
+                | (opts.skipFunctionBodies
+                    ? CXTranslationUnit_SkipFunctionBodies : 0),
+            &tu);
+    }
+    CgTuHandle htu(tu);
     if (err != CXError_Success) {
         std::cerr << "Failed parsing translation unit (code "
                   << static_cast<int>(err)
@@ -358,11 +574,40 @@ int synth::processTu(
         std::cerr << '\n';
         return err + 10;
     }
-
-    TuState state {TuAnnotationMap(), tu, multiTuProcessor, /*isC=*/ true};
-    clang_getInclusions(tu, &processFile, &state);
+    if (tuSpan.enabled())
+        tuSpan.addArg("tu", CgStr(clang_getTranslationUnitSpelling(tu)).gets());
+
+    TuState state {
+        TuAnnotationMap(),
+        tu,
+        multiTuProcessor,
+        /*isC=*/ true,
+        CursorCache(),
+        opts.deadline,
+        /*timedOut=*/ false,
+        /*nVisited=*/ 0};
+    auto const timedOut = [&]() {
+        std::cerr << "Time budget exceeded, discarding results of "
+                  << CgStr(clang_getTranslationUnitSpelling(tu)) << '\n';
+        return kTuTimedOut;
+    };
+    if (deadlinePassed(state))
+        return timedOut();
+    {
+        TraceSpan inclusionsSpan(tracer, "getInclusions");
+        clang_getInclusions(tu, &processFile, &state);
+    }
     annotate(state, clang_getTranslationUnitCursor(tu));
+    // writeHlTokens() publishes the results, so this is the last chance to
+    // back out.
+    if (deadlinePassed(state)) {
+        for (auto& fAnnotationsEntry : state.annotationMap)
+            multiTuProcessor.abandonFile(fAnnotationsEntry.second.file);
+        return timedOut();
+    }
     writeHlTokens(state);
+    multiTuProcessor.addCursorCacheStats(
+        state.cursorCache.lookups(), state.cursorCache.hits());
 
     return EXIT_SUCCESS;
 }
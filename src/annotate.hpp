@@ -3,12 +3,42 @@
 
 #include <clang-c/Index.h>
 
+#include <chrono>
+
 namespace synth {
 
 class MultiTuProcessor;
 
+struct ProcessTuOptions {
+    // If processing is still running at this point, it is abandoned at the
+    // next check and nothing is added to the MultiTuProcessor. Parsing itself
+    // cannot be interrupted, so this is only checked before and after it.
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+
+    // Cheaper parsing, at the expense of semantic highlighting in function
+    // bodies.
+    bool skipFunctionBodies = false;
+
+    // First parse cheaply (without function bodies and detailed preprocessing
+    // record) and skip the translation unit if all files it includes were
+    // already processed, since it would add nothing then. Worthwhile if its
+    // main file was already processed.
+    bool scanFirst = false;
+};
+
+// Returned by processTu() if scanFirst found nothing to process.
+int const kTuNothingNew = 8;
+
+// Returned by processTu() if the deadline was exceeded.
+int const kTuTimedOut = 9;
+
 int processTu(
-    CXIndex cidx, MultiTuProcessor& state, char const* const* args, int nargs);
+    CXIndex cidx,
+    MultiTuProcessor& state,
+    char const* const* args,
+    int nargs,
+    ProcessTuOptions const& opts = ProcessTuOptions());
 
 } // namespace synth
 
@@ -1,11 +1,15 @@
 #include "basicHl.hpp"
 
+#include "highlight.hpp"
 #include "output.hpp"
 
 #include <boost/assert.hpp>
 #include <boost/utility/string_ref.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <istream>
+#include <iterator>
 #include <limits>
 
 using namespace synth;
@@ -66,10 +70,11 @@ public:
         if (m_stream) {
             assert(m_offset == m_stream.tellg());
             m_stream.ignore(std::numeric_limits<std::streamsize>::max(), ch);
-            std::streampos off = m_stream.tellg();
-            assert(off >= 0);
-            assert(off <= std::numeric_limits<unsigned>::max());
-            m_offset = static_cast<unsigned>(off);
+            // Not tellg(), which fails if ch was not found before EOF.
+            m_offset += static_cast<unsigned>(m_stream.gcount());
+            // Like peek(), report that ch was not found.
+            if (m_stream.eof())
+                m_stream.setstate(std::ios::failbit);
         }
         return *this;
     }
@@ -124,6 +129,7 @@ static char skipUntilAny(CharStream& chs, char const* s)
 struct HlState {
     CharStream in;
     std::vector<Markup>& out;
+    bool atLineStart; // Only whitespace since the last newline.
 };
 
 static Markup& createMarkup(
@@ -152,6 +158,17 @@ static void skipQuotes(CharStream& chs, char quote)
     }
 }
 
+// Call after the opening R".
+static void skipRawString(CharStream& chs)
+{
+    char ch;
+    std::string delim = ")";
+    while (chs.get(ch) && ch != '(')
+        delim.push_back(ch);
+    delim += '"';
+    skipUntilAfter(chs, delim);
+}
+
 static bool hlStringNoPrefix(HlState& state, unsigned beg)
 {
     char ch;
@@ -168,12 +185,7 @@ static bool hlStringNoPrefix(HlState& state, unsigned beg)
             return false;
         }
         state.in.get(ch);
-
-        std::string delim = ")";
-        while (state.in.get(ch) && ch != '(')
-            delim.push_back(ch);
-        delim += '"';
-        skipUntilAfter(state.in, delim);
+        skipRawString(state.in);
         markTillHere(state, beg).attrs = TokenAttributes::litStr;
         return true;
     }
@@ -229,12 +241,178 @@ static void hlComment(HlState& state)
     markTillHere(state, beg).attrs = TokenAttributes::cmmt;
 }
 
+static char const kAsciiIdChars[] =
+    "abcdefghijklmnopqrstuvwxyz"
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "0123456789" "_" "$" /* $ is MS specific */;
+
+static bool isDigit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+// See the TODO in hlAdvance() about non-ASCII characters.
+static bool isIdChar(char ch)
+{
+    return ch < 0 || (ch != '\0' && std::strchr(kAsciiIdChars, ch))
+        || ch == '\\';
+}
+
+// Sorted, for std::binary_search().
+static char const* const kKeywords[] = {
+    "_Alignas", "_Alignof", "_Atomic", "_Bool", "_Complex", "_Generic",
+    "_Imaginary", "_Noreturn", "_Static_assert", "_Thread_local",
+    "alignas", "alignof", "asm", "auto", "bool", "break", "case", "catch",
+    "char", "char16_t", "char32_t", "char8_t", "class", "co_await",
+    "co_return", "co_yield", "concept", "const", "const_cast", "consteval",
+    "constexpr", "constinit", "continue", "decltype", "default", "delete",
+    "do", "double", "dynamic_cast", "else", "enum", "explicit", "export",
+    "extern", "false", "float", "for", "friend", "goto", "if", "inline",
+    "int", "long", "mutable", "namespace", "new", "noexcept", "nullptr",
+    "operator", "private", "protected", "public", "register",
+    "reinterpret_cast", "requires", "restrict", "return", "short", "signed",
+    "sizeof", "static", "static_assert", "static_cast", "struct", "switch",
+    "template", "this", "thread_local", "throw", "true", "try", "typedef",
+    "typeid", "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "wchar_t", "while"
+};
+
+static TokenAttributes getKeywordAttributes(boost::string_ref id)
+{
+    bool isKeyword = std::binary_search(
+        std::begin(kKeywords),
+        std::end(kKeywords),
+        id,
+        [](boost::string_ref lhs, boost::string_ref rhs) {
+            return lhs < rhs;
+        });
+    if (!isKeyword)
+        return TokenAttributes::none;
+    if (id == "true" || id == "false" || id == "nullptr" || id == "this")
+        return TokenAttributes::litKw;
+    switch (classifySpelling(id)) {
+        case SpellingClass::builtinType: return TokenAttributes::tyBuiltin;
+        case SpellingClass::opWord: return TokenAttributes::opWord;
+        default: return TokenAttributes::kw;
+    }
+}
+
+static bool isStringPrefix(boost::string_ref id)
+{
+    static char const* const kPrefixes[] = {
+        "L", "U", "u", "u8", "R", "LR", "UR", "uR", "u8R"};
+    return std::find(std::begin(kPrefixes), std::end(kPrefixes), id)
+        != std::end(kPrefixes);
+}
+
+// Call after the first character ch of an identifier, keyword or prefixed
+// string or character literal.
+static void hlIdentifier(char ch, HlState& state)
+{
+    unsigned beg = state.in.tellg() - 1;
+    std::string id(1, ch);
+    while (state.in.get(ch)) {
+        if (!isIdChar(ch)) {
+            state.in.unget(ch);
+            break;
+        }
+        id += ch;
+    }
+    char quote;
+    if (state.in.peek(quote) && (quote == '"' || quote == '\'')
+        && isStringPrefix(id)
+    ) {
+        BOOST_VERIFY(state.in.get(quote));
+        if (quote == '"' && id.back() == 'R')
+            skipRawString(state.in);
+        else
+            skipQuotes(state.in, quote);
+        markTillHere(state, beg).attrs = quote == '"'
+            ? TokenAttributes::litStr : TokenAttributes::litChr;
+        return;
+    }
+    TokenAttributes attrs = getKeywordAttributes(id);
+    if (attrs != TokenAttributes::none)
+        markTillHere(state, beg).attrs = attrs;
+}
+
+// Call after the first character ch of a preprocessing number.
+static void hlNumber(char ch, HlState& state)
+{
+    unsigned beg = state.in.tellg() - 1;
+    std::string sp(1, ch);
+    while (state.in.get(ch)) {
+        bool isExpSign = (ch == '+' || ch == '-')
+            && std::strchr("eEpP", sp.back());
+        if (!isIdChar(ch) && ch != '.' && ch != '\'' && !isExpSign) {
+            state.in.unget(ch);
+            break;
+        }
+        sp += ch;
+    }
+    bool isHex = sp.size() >= 2 && sp[0] == '0'
+        && (sp[1] == 'x' || sp[1] == 'X');
+    bool isFlt = sp.find('.') != std::string::npos
+        || sp.find_first_of(isHex ? "pP" : "eE") != std::string::npos;
+    markTillHere(state, beg).attrs = isFlt
+        ? TokenAttributes::litNumFlt : getIntTokenAttributes(sp);
+}
+
+// Call after the # that starts a preprocessing directive.
+static void hlDirective(HlState& state)
+{
+    unsigned beg = state.in.tellg() - 1;
+    char ch;
+    while (state.in.peek(ch) && (ch == ' ' || ch == '\t'))
+        BOOST_VERIFY(state.in.get(ch));
+    std::string name;
+    while (state.in.peek(ch) && isIdChar(ch)) {
+        BOOST_VERIFY(state.in.get(ch));
+        name += ch;
+    }
+    markTillHere(state, beg).attrs = TokenAttributes::pre;
+    if (name != "include" && name != "include_next" && name != "import")
+        return;
+
+    while (state.in.peek(ch) && (ch == ' ' || ch == '\t'))
+        BOOST_VERIFY(state.in.get(ch));
+    if (!state.in.peek(ch) || (ch != '<' && ch != '"'))
+        return;
+    unsigned fileBeg = state.in.tellg();
+    BOOST_VERIFY(state.in.get(ch));
+    if (skipUntilAny(state.in, ch == '<' ? ">\n" : "\"\n") == '\n')
+        state.in.unget('\n');
+    if (state.in.tellg() > fileBeg + 1)
+        markTillHere(state, fileBeg).attrs = TokenAttributes::preIncludeFile;
+}
+
+// Like hlAdvance(), but also for what processTu() would highlight.
+static void hlAdvanceLexical(char ch, HlState& state)
+{
+    bool atLineStart = state.atLineStart;
+    state.atLineStart = ch == '\n'
+        || (atLineStart && (ch == ' ' || ch == '\t'));
+    char next = '\0';
+    if (ch == '/') {
+        hlComment(state);
+    } else if (ch == '#' && atLineStart) {
+        hlDirective(state);
+    } else if (ch == '"' || ch == '\'') {
+        unsigned beg = state.in.tellg() - 1;
+        skipQuotes(state.in, ch);
+        markTillHere(state, beg).attrs = ch == '"'
+            ? TokenAttributes::litStr : TokenAttributes::litChr;
+    } else if (isDigit(ch)
+        || (ch == '.' && state.in.peek(next) && isDigit(next))
+    ) {
+        hlNumber(ch, state);
+    } else if (isIdChar(ch)) {
+        hlIdentifier(ch, state);
+    }
+}
+
 static void hlAdvance(char ch, HlState& state)
 {
-    static char const kAsciiIdChars[] =
-        "abcdefghijklmnopqrstuvwxyz"
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "0123456789" "_" "$" /* $ is MS specific */;
 
     switch (ch) {
         case '/':
@@ -265,9 +443,18 @@ static void hlAdvance(char ch, HlState& state)
 void synth::basicHighlightFile(std::istream& f, std::vector<Markup>& markups)
 {
     char ch;
-    HlState state {CharStream(f), markups};
+    HlState state {CharStream(f), markups, /*atLineStart=*/ true};
     if (state.in.tellg() == 0)
         hlString(state);
     while (state.in.get(ch))
         hlAdvance(ch, state);
 }
+
+void synth::lexicalHighlightFile(
+    std::istream& f, std::vector<Markup>& markups)
+{
+    char ch;
+    HlState state {CharStream(f), markups, /*atLineStart=*/ true};
+    while (state.in.get(ch))
+        hlAdvanceLexical(ch, state);
+}
@@ -10,6 +10,11 @@ struct Markup;
 
 void basicHighlightFile(std::istream& f, std::vector<Markup>& markups);
 
+// Highlights what basicHighlightFile() does and also what is otherwise left to
+// clang: keywords, string, character and number literals and preprocessing
+// directives. For files that no translation unit processed.
+void lexicalHighlightFile(std::istream& f, std::vector<Markup>& markups);
+
 } // namespace synth
 
 #endif // SYNTH_BASICHL_HPP_INCLUDED
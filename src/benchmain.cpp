@@ -0,0 +1,588 @@
+#include "CgStr.hpp"
+#include "DoxytagResolver.hpp"
+#include "MultiTuProcessor.hpp"
+#include "SimpleTemplate.hpp"
+#include "TokenTable.hpp"
+#include "annotate.hpp"
+#include "basicHl.hpp"
+#include "cgWrappers.hpp"
+#include "output.hpp"
+#include "xref.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/io/ios_state.hpp>
+#include <boost/variant/variant.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace synth;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchResult {
+    std::string name;
+    std::size_t iterations;
+    double nsPerIter; // Mean.
+    double minNsPerIter;
+    std::size_t itemsPerIter;
+    std::size_t bytesPerIter;
+};
+
+struct BenchOptions {
+    std::vector<char const*> filters; // Empty: Run all benchmarks.
+    double minSeconds;
+    char const* srcDir; // For the end-to-end benchmark.
+    char const* corpusDbDir; // Can be null.
+    std::vector<char const*> clangArgs;
+};
+
+// Runs each benchmark repeatedly until it took at least minSeconds in total
+// and collects the results.
+class BenchRunner {
+public:
+    explicit BenchRunner(BenchOptions const& opts)
+        : m_opts(opts)
+    { }
+
+    bool enabled(char const* name) const
+    {
+        if (m_opts.filters.empty())
+            return true;
+        return std::any_of(
+            m_opts.filters.begin(), m_opts.filters.end(),
+            [name](char const* f) { return std::strstr(name, f) != nullptr; });
+    }
+
+    // setup() is called before each iteration and is not included in the
+    // measured time.
+    template <typename Setup, typename Body>
+    void run(
+        char const* name,
+        std::size_t items,
+        std::size_t bytes,
+        Setup&& setup,
+        Body&& body)
+    {
+        if (!enabled(name))
+            return;
+        std::clog << "Running " << name << "..." << std::flush;
+        Clock::duration total {}, minDuration = Clock::duration::max();
+        std::size_t n = 0;
+        auto const minDuration_ = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(m_opts.minSeconds));
+        do {
+            setup();
+            Clock::time_point begin = Clock::now();
+            body();
+            Clock::duration d = Clock::now() - begin;
+            total += d;
+            minDuration = std::min(minDuration, d);
+            ++n;
+        } while (total < minDuration_);
+        using Ns = std::chrono::duration<double, std::nano>;
+        m_results.push_back({
+            name,
+            n,
+            Ns(total).count() / static_cast<double>(n),
+            Ns(minDuration).count(),
+            items,
+            bytes});
+        std::clog << ' ' << m_results.back().nsPerIter / 1e6 << " ms\n";
+    }
+
+    template <typename Body>
+    void run(
+        char const* name, std::size_t items, std::size_t bytes, Body&& body)
+    {
+        run(name, items, bytes, [] { }, std::forward<Body>(body));
+    }
+
+    void writeJson(std::ostream& out) const;
+
+private:
+    BenchOptions const& m_opts;
+    std::vector<BenchResult> m_results;
+};
+
+// Removes the directory with all its contents on destruction.
+class TempDir {
+public:
+    TempDir()
+        : m_path(fs::temp_directory_path()
+            / fs::unique_path("synth-bench-%%%%-%%%%-%%%%"))
+    {
+        fs::create_directories(m_path);
+    }
+
+    TempDir(TempDir const&) = delete;
+    TempDir& operator= (TempDir const&) = delete;
+
+    ~TempDir()
+    {
+        boost::system::error_code ec;
+        fs::remove_all(m_path, ec);
+    }
+
+    fs::path const& path() const { return m_path; }
+
+private:
+    fs::path m_path;
+};
+
+} // anonymous namespace
+
+// Used to keep the compiler from optimizing away benchmarked computations.
+static volatile std::size_t g_sink;
+
+void BenchRunner::writeJson(std::ostream& out) const
+{
+    boost::io::ios_all_saver saver(out);
+    out << std::fixed << std::setprecision(1);
+    out << "{\n  \"benchmarks\": [";
+    bool first = true;
+    for (BenchResult const& r : m_results) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        // Benchmark names contain no characters that need escaping.
+        out << "    {\"name\": \"" << r.name << '"'
+            << ", \"iterations\": " << r.iterations
+            << ", \"ns_per_iter\": " << r.nsPerIter
+            << ", \"min_ns_per_iter\": " << r.minNsPerIter
+            << ", \"items_per_iter\": " << r.itemsPerIter
+            << ", \"bytes_per_iter\": " << r.bytesPerIter
+            << '}';
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Generates C++-like source code with comments, literals, preprocessor
+// directives and lots of identifiers. Deterministic for a given seed. "@" in
+// the line templates is replaced with the line index.
+static std::string generateSource(std::size_t nLines, unsigned seed)
+{
+    static char const* const kLines[] = {
+        "// Line comment with some words in it: foo bar baz.",
+        "/* A block comment spanning\n   two lines. */",
+        "#include <vector>",
+        "#define MAX_VALUE(a, b) ((a) > (b) ? (a) : (b))",
+        "namespace ns@ {",
+        "}",
+        "int func@(int arg, char const* str) { return arg * 0x1f + 42; }",
+        "std::string const kText@ = \"string \\\"literal\\\" @\";",
+        "    double value@ = 3.14159e10 + static_cast<double>(@);",
+        "    if (value@ > 100 && !flag) return 'c';",
+        "template <typename T> struct Holder@ { T member@; };",
+        "",
+    };
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<std::size_t> lineDist(
+        0, sizeof(kLines) / sizeof(kLines[0]) - 1);
+    std::string r;
+    for (std::size_t i = 0; i < nLines; ++i) {
+        std::string n = std::to_string(i);
+        for (char const* c = kLines[lineDist(rng)]; *c; ++c) {
+            if (*c == '@')
+                r += n;
+            else
+                r += *c;
+        }
+        r += '\n';
+    }
+    return r;
+}
+
+static bool isIdentifierChar(char c)
+{
+    return c == '_'
+        || (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9');
+}
+
+// Creates a sorted markup for each identifier or number in src. Every third
+// one links somewhere.
+static std::vector<Markup> generateMarkups(std::string const& src)
+{
+    std::vector<Markup> r;
+    std::size_t i = 0;
+    while (i < src.size()) {
+        if (!isIdentifierChar(src[i])) {
+            ++i;
+            continue;
+        }
+        std::size_t beg = i;
+        while (i < src.size() && isIdentifierChar(src[i]))
+            ++i;
+        auto kind = static_cast<TokenAttributesUnderlying>(
+            1 + r.size() % static_cast<TokenAttributesUnderlying>(
+                TokenAttributes::varNonstaticMember));
+        Markup m {
+            static_cast<unsigned>(beg),
+            static_cast<unsigned>(i),
+            static_cast<TokenAttributes>(kind),
+            nullptr,
+            CodeRef()};
+        if (r.size() % 3 == 0) {
+            m.refd = [](fs::path const&, MultiTuProcessor&) {
+                return std::string("other.cpp.html#42L");
+            };
+        }
+        r.push_back(std::move(m));
+    }
+    return r;
+}
+
+static void writeFile(fs::path const& p, std::string const& contents)
+{
+    fs::ofstream f(p, std::ios::binary);
+    f.exceptions(std::ios::badbit | std::ios::failbit);
+    f << contents;
+}
+
+static void benchHighlightedOutput(BenchRunner& runner, TempDir const& tmp)
+{
+    std::string const src = generateSource(20000, 1);
+    fs::path const srcPath = tmp.path() / "hl.cpp";
+    writeFile(srcPath, src);
+    std::vector<Markup> const markups = generateMarkups(src);
+
+    runner.run("basicHighlightFile", 20000, src.size(), [&] {
+        std::istringstream in(src);
+        std::vector<Markup> result;
+        basicHighlightFile(in, result);
+        g_sink = result.size();
+    });
+
+    std::vector<Markup> shuffled;
+    runner.run("sortMarkups", markups.size(), 0, [&] {
+        shuffled = markups;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(2));
+    }, [&] {
+        sortMarkups(shuffled);
+    });
+
+    std::vector<Markup> suppMarkups;
+    {
+        std::istringstream in(src);
+        basicHighlightFile(in, suppMarkups);
+        sortMarkups(suppMarkups);
+    }
+    std::pair<fs::path, fs::path> const inOutDir(tmp.path(), tmp.path());
+    HighlightedFile hlFile;
+    hlFile.fname = "hl.cpp";
+    hlFile.inOutDir = &inOutDir;
+    runner.run("supplementMarkups", suppMarkups.size(), 0, [&] {
+        hlFile.markups = markups;
+    }, [&] {
+        hlFile.supplementMarkups(suppMarkups);
+    });
+
+    MultiTuProcessor multiTuProcessor(PathMap(), [](Markup&, CXCursor) { });
+    fs::ifstream srcIn(srcPath, std::ios::binary);
+    std::ostringstream out;
+    runner.run("HighlightedFile::writeTo", hlFile.markups.size(), src.size(),
+    [&] {
+        srcIn.clear();
+        srcIn.seekg(0);
+        out.str(std::string());
+    }, [&] {
+        hlFile.writeTo(out, multiTuProcessor, srcIn);
+    });
+}
+
+static void benchTemplate(BenchRunner& runner)
+{
+    std::string text;
+    for (unsigned i = 0; i < 1000; ++i) {
+        text += "<div class=\"entry\">@@key";
+        text += std::to_string(i % 10);
+        text += "@@</div><a href=\"@@rootpath@@/x.html\">link</a>\n";
+    }
+    SimpleTemplate const tpl(text);
+    SimpleTemplate::Context ctx;
+    for (unsigned i = 0; i < 10; ++i)
+        ctx["key" + std::to_string(i)] = std::string(40, 'a');
+    ctx["rootpath"] = SimpleTemplate::ValCallback([](std::ostream& out) {
+        out << "../..";
+    });
+    std::ostringstream out;
+    runner.run("SimpleTemplate::writeTo", 2000, text.size(), [&] {
+        out.str(std::string());
+    }, [&] {
+        tpl.writeTo(out, ctx);
+    });
+}
+
+static CXChildVisitResult collectDeclarations(
+    CXCursor cur, CXCursor, CXClientData ud)
+{
+    if (clang_isDeclaration(clang_getCursorKind(cur)))
+        static_cast<std::vector<CXCursor>*>(ud)->push_back(cur);
+    return CXChildVisit_Recurse;
+}
+
+static void benchFileUniqueName(BenchRunner& runner, CXIndex cidx)
+{
+    if (!runner.enabled("fileUniqueName"))
+        return;
+    std::string code;
+    for (unsigned i = 0; i < 500; ++i) {
+        std::string n = std::to_string(i);
+        code += "namespace ns" + n + " { namespace inner {\n"
+            "struct S" + n + " { void m(int, char const*, double); };\n"
+            "template <typename T> struct T" + n + " { T x; };\n"
+            "typedef S" + n + " A" + n + ";\n"
+            "int f" + n + "(unsigned long a, S" + n + " const& s, ...);\n"
+            "enum E" + n + " { e" + n + "a, e" + n + "b };\n"
+            "extern int v" + n + ";\n"
+            "} }\n";
+    }
+    CXUnsavedFile unsaved {
+        "bench.cpp", code.c_str(), static_cast<unsigned long>(code.size())};
+    char const* const args[] = {"-std=c++14"};
+    CXTranslationUnit tu = nullptr;
+    CXErrorCode err = clang_parseTranslationUnit2(
+        cidx, "bench.cpp", args, 1, &unsaved, 1,
+        CXTranslationUnit_None, &tu);
+    CgTuHandle htu(tu);
+    if (err != CXError_Success) {
+        std::cerr << "fileUniqueName: Failed parsing generated code.\n";
+        return;
+    }
+    std::vector<CXCursor> decls;
+    clang_visitChildren(
+        clang_getTranslationUnitCursor(tu), &collectDeclarations, &decls);
+
+    runner.run("fileUniqueName", decls.size(), 0, [&] {
+        std::size_t n = 0;
+        for (CXCursor const& cur : decls)
+            n += fileUniqueName(cur, /*isC=*/ false).size();
+        g_sink = n;
+    });
+}
+
+static void benchDoxytags(BenchRunner& runner, TempDir const& tmp)
+{
+    if (!runner.enabled("DoxytagResolver"))
+        return;
+    std::string xml = "<?xml version='1.0' encoding='UTF-8' standalone='yes' ?>\n"
+        "<tagfile>\n";
+    for (unsigned i = 0; i < 2000; ++i) {
+        std::string n = std::to_string(i);
+        xml += "  <compound kind=\"class\">\n"
+            "    <name>ns::Class" + n + "</name>\n"
+            "    <filename>classns_1_1Class" + n + ".html</filename>\n";
+        for (unsigned j = 0; j < 10; ++j) {
+            std::string m = std::to_string(j);
+            xml += "    <member kind=\"function\">\n"
+                "      <name>member" + m + "</name>\n"
+                "      <anchorfile>classns_1_1Class" + n + ".html</anchorfile>\n"
+                "      <anchor>a" + n + "_" + m + "</anchor>\n"
+                "    </member>\n";
+        }
+        xml += "  </compound>\n";
+    }
+    xml += "</tagfile>\n";
+    fs::path const tagPath = tmp.path() / "tags.xml";
+    writeFile(tagPath, xml);
+
+    runner.run("DoxytagResolver::fromTagFilename", 2000 * 11, xml.size(), [&] {
+        DoxytagResolver resolver = DoxytagResolver::fromTagFilename(
+            tagPath, "http://example.com/");
+        (void)resolver;
+    });
+}
+
+static void benchTokenTable(BenchRunner& runner)
+{
+    if (!runner.enabled("TokenTable::find"))
+        return;
+    std::size_t const nTokens = 1000000;
+    std::size_t const nLookups = 100000;
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<unsigned> gapDist(1, 12);
+    TokenTable table;
+    table.beginOffsets.reserve(nTokens);
+    unsigned off = 0;
+    for (std::size_t i = 0; i < nTokens; ++i) {
+        off += gapDist(rng);
+        table.beginOffsets.push_back(off);
+    }
+    // Half of the lookups hit a token, the other half misses.
+    std::vector<unsigned> lookups;
+    lookups.reserve(nLookups);
+    std::uniform_int_distribution<std::size_t> idxDist(0, nTokens - 1);
+    for (std::size_t i = 0; i < nLookups; ++i) {
+        unsigned tokOff = table.beginOffsets[idxDist(rng)];
+        lookups.push_back(i % 2 == 0 ? tokOff : tokOff + 1);
+    }
+
+    runner.run("TokenTable::find", nLookups, 0, [&] {
+        std::size_t n = 0;
+        for (unsigned lookupOff : lookups)
+            n += table.find(lookupOff) != SIZE_MAX;
+        g_sink = n;
+    });
+}
+
+// Runs synth over all of cmds (each a complete clang commandline), linking
+// and writing output for the files under inDir.
+static void runEndToEnd(
+    BenchRunner& runner,
+    char const* name,
+    fs::path const& inDir,
+    std::vector<std::vector<std::string>> const& cmds,
+    std::size_t nBytes,
+    TempDir const& tmp)
+{
+    fs::path const outDir = tmp.path() / "html";
+    SimpleTemplate const tpl("<pre>@@code@@</pre>");
+
+    runner.run(name, cmds.size(), nBytes, [&] {
+        fs::remove_all(outDir);
+    }, [&] {
+        CgIdxHandle hcidx(clang_createIndex(
+            /*excludeDeclarationsFromPCH:*/ true,
+            /*displayDiagnostics:*/ false));
+        MultiTuProcessor state(
+            PathMap{{inDir, outDir}}, [](Markup&, CXCursor) { });
+        std::vector<char const*> args;
+        for (auto const& cmd : cmds) {
+            args.clear();
+            for (std::string const& arg : cmd)
+                args.push_back(arg.c_str());
+            processTu(
+                hcidx.get(),
+                state,
+                args.data(),
+                static_cast<int>(args.size()));
+        }
+        state.writeOutput(tpl);
+    });
+}
+
+static void benchEndToEnd(
+    BenchRunner& runner, BenchOptions const& opts, TempDir const& tmp)
+{
+    if (!runner.enabled("endToEnd/src"))
+        return;
+    fs::path const srcDir = fs::canonical(opts.srcDir);
+    std::vector<std::vector<std::string>> cmds;
+    std::size_t nBytes = 0;
+    for (auto const& entry : fs::directory_iterator(srcDir)) {
+        if (entry.path().extension() != ".cpp")
+            continue;
+        std::vector<std::string> cmd {
+            "clang++", "-std=c++14", "-I", SYNTH_BENCH_CLANG_INCLUDE_DIR};
+        cmd.insert(cmd.end(), opts.clangArgs.begin(), opts.clangArgs.end());
+        cmd.push_back(entry.path().string());
+        cmds.push_back(std::move(cmd));
+        nBytes += static_cast<std::size_t>(fs::file_size(entry.path()));
+    }
+    std::sort(cmds.begin(), cmds.end());
+    runEndToEnd(runner, "endToEnd/src", srcDir, cmds, nBytes, tmp);
+}
+
+// Runs synth over a compilation database, e.g. one created by
+// synth-gencorpus. The working directories of the commands are ignored, so
+// they must use absolute paths.
+static void benchCorpus(
+    BenchRunner& runner, BenchOptions const& opts, TempDir const& tmp)
+{
+    if (!opts.corpusDbDir || !runner.enabled("endToEnd/db"))
+        return;
+    CXCompilationDatabase_Error err;
+    CgDbHandle db(clang_CompilationDatabase_fromDirectory(
+        opts.corpusDbDir, &err));
+    if (err != CXCompilationDatabase_NoError) {
+        std::cerr << "Failed loading compilation database from "
+                  << opts.corpusDbDir << '\n';
+        return;
+    }
+    CgCmdsHandle hcmds(clang_CompilationDatabase_getAllCompileCommands(
+        db.get()));
+    unsigned nCmds = clang_CompileCommands_getSize(hcmds.get());
+    std::vector<std::vector<std::string>> cmds;
+    std::size_t nBytes = 0;
+    for (unsigned i = 0; i < nCmds; ++i) {
+        CXCompileCommand cmd = clang_CompileCommands_getCommand(hcmds.get(), i);
+        std::vector<std::string> args;
+        unsigned nArgs = clang_CompileCommand_getNumArgs(cmd);
+        for (unsigned j = 0; j < nArgs; ++j)
+            args.push_back(CgStr(clang_CompileCommand_getArg(cmd, j)).gets());
+        args.insert(args.end(), opts.clangArgs.begin(), opts.clangArgs.end());
+        boost::system::error_code ec;
+        nBytes += static_cast<std::size_t>(fs::file_size(
+            CgStr(clang_CompileCommand_getFilename(cmd)).gets(), ec));
+        cmds.push_back(std::move(args));
+    }
+    runEndToEnd(
+        runner, "endToEnd/db", fs::canonical(opts.corpusDbDir), cmds, nBytes,
+        tmp);
+}
+
+static void printUsage()
+{
+    std::cerr << "Usage: synth-bench [--filter <substring>]... [--min-time <s>]"
+                 " [--src <dir>] [--db <dbdir>] [-e <clangarg>]...\n";
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opts {
+        {},
+        0.5,
+        SYNTH_BENCH_SRC_DIR,
+        nullptr,
+        {}};
+    for (int i = 1; i < argc; ++i) {
+        bool hasVal = i + 1 < argc;
+        if (hasVal && !std::strcmp(argv[i], "--filter")) {
+            opts.filters.push_back(argv[++i]);
+        } else if (hasVal && !std::strcmp(argv[i], "--min-time")) {
+            opts.minSeconds = std::atof(argv[++i]);
+        } else if (hasVal && !std::strcmp(argv[i], "--src")) {
+            opts.srcDir = argv[++i];
+        } else if (hasVal && !std::strcmp(argv[i], "--db")) {
+            opts.corpusDbDir = argv[++i];
+        } else if (hasVal && !std::strcmp(argv[i], "-e")) {
+            // Extra arguments for the end-to-end benchmark.
+            opts.clangArgs.push_back(argv[++i]);
+        } else {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        BenchRunner runner(opts);
+        TempDir tmp;
+        CgIdxHandle hcidx(clang_createIndex(
+            /*excludeDeclarationsFromPCH:*/ true,
+            /*displayDiagnostics:*/ false));
+        benchHighlightedOutput(runner, tmp);
+        benchTemplate(runner);
+        benchFileUniqueName(runner, hcidx.get());
+        benchDoxytags(runner, tmp);
+        benchTokenTable(runner);
+        benchEndToEnd(runner, opts, tmp);
+        benchCorpus(runner, opts, tmp);
+        runner.writeJson(std::cout);
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -40,6 +40,29 @@ static unsigned getUintOptVal(char const* const* opt)
     return static_cast<unsigned>(n);
 }
 
+// Parses "<i>/<n>".
+static void parseShard(char const* val, CmdLineArgs& r)
+{
+    char const* slash = std::strchr(val, '/');
+    try {
+        if (!slash)
+            throw std::invalid_argument("missing '/'");
+        std::size_t endIdx, endN;
+        int idx = std::stoi(std::string(val, slash), &endIdx);
+        int n = std::stoi(slash + 1, &endN);
+        if (val + endIdx != slash || slash[1 + endN] != '\0')
+            throw std::invalid_argument("trailing characters");
+        if (idx < 0 || n <= 0 || idx >= n)
+            throw std::out_of_range("0 <= <i> < <n> required");
+        r.shardIdx = static_cast<unsigned>(idx);
+        r.nShards = static_cast<unsigned>(n);
+    } catch (std::exception const& e) {
+        throw std::runtime_error(
+            std::string("Bad value for --shard (expected <i>/<n>): ")
+            + e.what());
+    }
+}
+
 CmdLineArgs CmdLineArgs::parse(int argc, char const* const* argv)
 {
     if (argc < 3)
@@ -64,6 +87,26 @@ CmdLineArgs CmdLineArgs::parse(int argc, char const* const* argv)
             if (maxIdSzFound)
                 throw std::runtime_error("Duplicate option --max-id-sz.");
             r.maxIdSz = getUintOptVal(argv + i++);
+        } else if (!std::strcmp(argv[i], "--tu-timeout")) {
+            if (r.tuTimeout != 0)
+                throw std::runtime_error("Duplicate option --tu-timeout.");
+            r.tuTimeout = getUintOptVal(argv + i++);
+        } else if (!std::strcmp(argv[i], "--tu-timeout-retry")) {
+            r.tuTimeoutRetry = true;
+        } else if (!std::strcmp(argv[i], "--max-memory")) {
+            if (r.maxMemoryMiB != 0)
+                throw std::runtime_error("Duplicate option --max-memory.");
+            r.maxMemoryMiB = getUintOptVal(argv + i++);
+        } else if (!std::strcmp(argv[i], "--fork")) {
+            r.forkWorkers = true;
+        } else if (!std::strcmp(argv[i], "--watch")) {
+            r.watch = true;
+        } else if (!std::strcmp(argv[i], "--lexical")) {
+            r.lexicalOnly = true;
+        } else if (!std::strcmp(argv[i], "--all-configs")) {
+            r.allConfigs = true;
+        } else if (!std::strcmp(argv[i], "--progressive")) {
+            r.progressive = true;
         } else if (!std::strcmp(argv[i], "-o")) {
             if (r.inOutDirs.empty()) {
                 throw std::runtime_error(
@@ -75,6 +118,24 @@ CmdLineArgs CmdLineArgs::parse(int argc, char const* const* argv)
             getOptVal(argv + i++, tagOpts.first);
             getOptVal(argv + i++, tagOpts.second);
             r.doxyTagFiles.push_back(std::move(tagOpts));
+        } else if (!std::strcmp(argv[i], "--trace")) {
+            getOptVal(argv + i++, r.traceFile);
+        } else if (!std::strcmp(argv[i], "--metrics")) {
+            getOptVal(argv + i++, r.metricsFile);
+        } else if (!std::strcmp(argv[i], "--stats")) {
+            r.printStats = true;
+        } else if (!std::strcmp(argv[i], "--write-index")) {
+            getOptVal(argv + i++, r.indexOutFile);
+        } else if (!std::strcmp(argv[i], "--from-index")) {
+            r.indexInFiles.push_back(getOptVal(argv + i++));
+        } else if (!std::strcmp(argv[i], "--cmds-from")) {
+            getOptVal(argv + i++, r.cmdStreamFile);
+        } else if (!std::strcmp(argv[i], "--changed")) {
+            getOptVal(argv + i++, r.changedFilesList);
+        } else if (!std::strcmp(argv[i], "--shard")) {
+            if (r.nShards != 0)
+                throw std::runtime_error("Duplicate option --shard.");
+            parseShard(getOptVal(argv + i++), r);
         } else if (!std::strcmp(argv[i], "--cmd")) {
             // These come before any extra-args, thus use insert(begin(), ...).
             r.clangArgs.insert(r.clangArgs.begin(), argv + i + 1, argv + argc);
@@ -92,11 +153,74 @@ CmdLineArgs CmdLineArgs::parse(int argc, char const* const* argv)
         }
     }
 
+    if (r.changedFilesList) {
+        if (r.indexInFiles.empty() || !r.compilationDbDir) {
+            throw std::runtime_error(
+                "--changed requires --from-index and --db.");
+        }
+        if (r.forkWorkers || r.watch || r.maxMemoryMiB != 0) {
+            throw std::runtime_error(
+                "--changed cannot be combined with --fork, --watch or"
+                " --max-memory.");
+        }
+    }
+    if (!r.indexInFiles.empty()) {
+        if (foundCmd && !r.changedFilesList)
+            throw std::runtime_error("--from-index replaces --cmd and --db.");
+        if (!r.inOutDirs.empty()) {
+            throw std::runtime_error(
+                "With --from-index, directories are taken from the index.");
+        }
+        foundCmd = true;
+    }
+    if (r.cmdStreamFile) {
+        if (foundCmd) {
+            throw std::runtime_error(
+                "--cmds-from replaces --cmd, --db and --from-index.");
+        }
+        foundCmd = true;
+    }
+    if (r.lexicalOnly) {
+        if (foundCmd) {
+            throw std::runtime_error(
+                "--lexical replaces --cmd, --db, --cmds-from and"
+                " --from-index.");
+        }
+        foundCmd = true;
+    }
+    if (r.nShards != 0 && !r.compilationDbDir)
+        throw std::runtime_error("--shard requires --db.");
     if (!foundCmd)
         throw std::runtime_error("Missing command.");
     if (i != argc)
         throw std::runtime_error("Superfluous commandline arguments.");
 
+    if (r.tuTimeoutRetry && r.tuTimeout == 0)
+        throw std::runtime_error("--tu-timeout-retry requires --tu-timeout.");
+    if (r.forkWorkers && !r.compilationDbDir)
+        throw std::runtime_error("--fork requires --db.");
+    if (r.allConfigs && !r.compilationDbDir && !r.cmdStreamFile)
+        throw std::runtime_error("--all-configs requires --db or --cmds-from.");
+    if (r.progressive) {
+        if (!r.compilationDbDir && !r.cmdStreamFile) {
+            throw std::runtime_error(
+                "--progressive requires --db or --cmds-from.");
+        }
+        if (r.maxMemoryMiB != 0 || r.indexOutFile || r.changedFilesList) {
+            throw std::runtime_error(
+                "--progressive cannot be combined with --max-memory,"
+                " --write-index or --changed.");
+        }
+    }
+    if (r.watch) {
+        if (!r.compilationDbDir)
+            throw std::runtime_error("--watch requires --db.");
+        if (r.forkWorkers || r.maxMemoryMiB != 0 || r.indexOutFile) {
+            throw std::runtime_error(
+                "--watch cannot be combined with --fork, --max-memory or"
+                " --write-index.");
+        }
+    }
     if (r.nThreads == 0)
         r.nThreads = std::thread::hardware_concurrency();
     for (auto& dir : r.inOutDirs) {
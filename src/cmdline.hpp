@@ -20,11 +20,63 @@ struct CmdLineArgs {
 
     char const* compilationDbDir;
 
+    // If not null, read compile commands from this file or FIFO ("-": stdin)
+    // as they arrive, one JSON object per line.
+    char const* cmdStreamFile;
+
+    // Instead of running clang, highlight all files below the input
+    // directories lexically.
+    bool lexicalOnly;
+
+    // Also process compile commands for main files that an earlier command
+    // already has (last, if known up front), instead of skipping them.
+    bool allConfigs;
+
+    // First write all files below the input directories lexically highlighted,
+    // then replace each one as soon as it is fully processed.
+    bool progressive;
+
+    // Only process compile commands of shard shardIdx of nShards (if not 0).
+    unsigned shardIdx;
+    unsigned nShards;
+
+    // If not empty, merge these indexes and render the output from them
+    // instead of running clang.
+    std::vector<char const*> indexInFiles;
+
+    // If not null, write an index here instead of the output.
+    char const* indexOutFile;
+
+    // If not null, read changed files from here (one per line, "-": stdin)
+    // and only reprocess the compile commands affected by them, on top of the
+    // indexInFiles.
+    char const* changedFilesList;
+
     static CmdLineArgs parse(int argc, char const* const* argv);
 
     unsigned nThreads;
 
     unsigned maxIdSz;
+
+    // Process each TU in a forked child process instead of a thread.
+    bool forkWorkers;
+
+    unsigned tuTimeout; // Seconds, 0: Unlimited.
+    bool tuTimeoutRetry;
+
+    // If not null, write a Chrome trace_event file with phase timings here.
+    char const* traceFile;
+
+    bool printStats;
+
+    // Move markups to a temporary file beyond this many MiB, 0: Unlimited.
+    unsigned maxMemoryMiB;
+
+    // If not null, periodically write Prometheus metrics to this file.
+    char const* metricsFile;
+
+    // After writing the output, keep updating it when input files change.
+    bool watch;
 };
 
 } // namespace synth
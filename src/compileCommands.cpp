@@ -0,0 +1,385 @@
+#include "compileCommands.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace synth;
+
+namespace {
+
+// Just enough JSON for compilation databases.
+class JsonReader {
+public:
+    JsonReader(char const* begin, char const* end)
+        : m_pos(begin), m_end(end)
+    { }
+
+    void skipWs()
+    {
+        while (m_pos != m_end && std::strchr(" \t\r\n", *m_pos) && *m_pos)
+            ++m_pos;
+    }
+
+    bool atEnd()
+    {
+        skipWs();
+        return m_pos == m_end;
+    }
+
+    // Skips whitespace and returns the position of the next value.
+    char const* pos()
+    {
+        skipWs();
+        return m_pos;
+    }
+
+    // Skips whitespace and returns the next character, without consuming it.
+    char peek()
+    {
+        skipWs();
+        if (m_pos == m_end)
+            fail("Unexpected end");
+        return *m_pos;
+    }
+
+    // Consumes c if it is the next character.
+    bool consume(char c)
+    {
+        if (peek() != c)
+            return false;
+        ++m_pos;
+        return true;
+    }
+
+    void expect(char c)
+    {
+        if (!consume(c))
+            fail(std::string("Expected '") + c + "'");
+    }
+
+    std::string readString()
+    {
+        expect('"');
+        std::string r;
+        for (;;) {
+            if (m_pos == m_end)
+                fail("Unterminated string");
+            char c = *m_pos++;
+            if (c == '"')
+                return r;
+            if (c != '\\') {
+                r += c;
+                continue;
+            }
+            if (m_pos == m_end)
+                fail("Unterminated string");
+            c = *m_pos++;
+            switch (c) {
+                case 'b': r += '\b'; break;
+                case 'f': r += '\f'; break;
+                case 'n': r += '\n'; break;
+                case 'r': r += '\r'; break;
+                case 't': r += '\t'; break;
+                case 'u': appendUtf8(r, readCodePoint()); break;
+                default: r += c; break; // '"', '\\' and '/'.
+            }
+        }
+    }
+
+    std::vector<std::string> readStringArray()
+    {
+        std::vector<std::string> r;
+        expect('[');
+        if (consume(']'))
+            return r;
+        do
+            r.push_back(readString());
+        while (consume(','));
+        expect(']');
+        return r;
+    }
+
+    // Skips a value of any type.
+    void skipValue()
+    {
+        char c = peek();
+        if (c == '"') {
+            readString();
+        } else if (c == '[' || c == '{') {
+            char close = c == '[' ? ']' : '}';
+            ++m_pos;
+            if (consume(close))
+                return;
+            do {
+                if (close == '}') {
+                    readString();
+                    expect(':');
+                }
+                skipValue();
+            } while (consume(','));
+            expect(close);
+        } else {
+            // Numbers, true, false, null.
+            char const* begin = m_pos;
+            while (m_pos != m_end && !std::strchr(",]} \t\r\n", *m_pos))
+                ++m_pos;
+            if (m_pos == begin)
+                fail("Expected value");
+        }
+    }
+
+    [[noreturn]] static void fail(std::string const& msg)
+    {
+        throw std::runtime_error("Malformed compile command: " + msg + ".");
+    }
+
+private:
+    unsigned readHex4()
+    {
+        if (m_end - m_pos < 4)
+            fail("Truncated \\u escape");
+        unsigned r = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *m_pos++;
+            r <<= 4;
+            if (c >= '0' && c <= '9')
+                r |= static_cast<unsigned>(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                r |= static_cast<unsigned>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                r |= static_cast<unsigned>(c - 'A' + 10);
+            else
+                fail("Bad \\u escape");
+        }
+        return r;
+    }
+
+    std::uint32_t readCodePoint()
+    {
+        std::uint32_t cp = readHex4();
+        if (cp >= 0xD800 && cp < 0xDC00 && m_end - m_pos >= 6
+            && m_pos[0] == '\\' && m_pos[1] == 'u'
+        ) {
+            m_pos += 2;
+            std::uint32_t low = readHex4();
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+        return cp;
+    }
+
+    static void appendUtf8(std::string& out, std::uint32_t cp)
+    {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    char const* m_pos;
+    char const* m_end;
+};
+
+// An entry whose arguments are neither split nor copied yet.
+struct RawCompileCommand {
+    CompileCommand cmd; // Without args.
+    char const* arguments = nullptr; // The "arguments" value, if any.
+    char const* command = nullptr; // The "command" value, if any.
+};
+
+} // anonymous namespace
+
+// Splits like a POSIX shell, without expansions (as clang does).
+static std::vector<std::string> splitCommand(std::string const& cmd)
+{
+    std::vector<std::string> r;
+    std::string arg;
+    bool inArg = false;
+    char quote = '\0';
+    for (std::size_t i = 0; i < cmd.size(); ++i) {
+        char c = cmd[i];
+        if (quote == '\'') {
+            if (c == '\'')
+                quote = '\0';
+            else
+                arg += c;
+        } else if (c == '\\' && i + 1 < cmd.size()
+            && (quote != '"' || std::strchr("\"\\$`", cmd[i + 1]))
+        ) {
+            arg += cmd[++i];
+        } else if (quote == '"') {
+            if (c == '"')
+                quote = '\0';
+            else
+                arg += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            inArg = true;
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            if (inArg)
+                r.push_back(std::move(arg));
+            arg.clear();
+            inArg = false;
+            continue;
+        } else {
+            arg += c;
+        }
+        inArg = true;
+    }
+    if (inArg)
+        r.push_back(std::move(arg));
+    return r;
+}
+
+static void removeCompilerWrappers(std::vector<std::string>& args)
+{
+    while (args.size() > 1 && args[1][0] != '-') {
+        std::string name = boost::filesystem::path(args[0]).stem().string();
+        if (name != "ccache" && name != "distcc" && name != "sccache")
+            return;
+        args.erase(args.begin());
+    }
+}
+
+// Reads an entry, only remembering where its arguments are.
+static RawCompileCommand readRawCommand(JsonReader& in)
+{
+    RawCompileCommand r;
+    bool hasDirectory = false, hasFile = false;
+    in.expect('{');
+    if (!in.consume('}')) {
+        do {
+            std::string key = in.readString();
+            in.expect(':');
+            if (key == "directory") {
+                r.cmd.directory = in.readString();
+                hasDirectory = true;
+            } else if (key == "file") {
+                r.cmd.file = in.readString();
+                hasFile = true;
+            } else {
+                if (key == "arguments")
+                    r.arguments = in.pos();
+                else if (key == "command")
+                    r.command = in.pos();
+                in.skipValue();
+            }
+        } while (in.consume(','));
+        in.expect('}');
+    }
+    if (!hasDirectory || !hasFile)
+        JsonReader::fail("\"directory\" or \"file\" missing");
+    return r;
+}
+
+// Sets raw.cmd.args, preferring "arguments" over "command" like clang.
+static void readArgs(RawCompileCommand& raw, char const* end)
+{
+    std::vector<std::string>& args = raw.cmd.args;
+    if (raw.arguments)
+        args = JsonReader(raw.arguments, end).readStringArray();
+    else if (raw.command)
+        args = splitCommand(JsonReader(raw.command, end).readString());
+    removeCompilerWrappers(args);
+    if (args.empty())
+        JsonReader::fail("No arguments");
+}
+
+CompileCommand synth::parseCompileCommand(char const* begin, char const* end)
+{
+    JsonReader in(begin, end);
+    RawCompileCommand raw = readRawCommand(in);
+    if (!in.atEnd())
+        in.fail("Trailing data");
+    readArgs(raw, end);
+    return std::move(raw.cmd);
+}
+
+static std::size_t hashCommand(CompileCommand const& cmd)
+{
+    std::size_t h = 0;
+    boost::hash_combine(h, cmd.directory);
+    boost::hash_combine(h, cmd.file);
+    boost::hash_range(h, cmd.args.begin(), cmd.args.end());
+    return h;
+}
+
+static bool isSameCommand(CompileCommand const& a, CompileCommand const& b)
+{
+    return a.directory == b.directory && a.file == b.file && a.args == b.args;
+}
+
+static std::string readFile(fs::path const& fname)
+{
+    std::ifstream in(fname.string(), std::ios::in | std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open " + fname.string() + ".");
+    in.seekg(0, std::ios::end);
+    std::string r(static_cast<std::size_t>(in.tellg()), '\0');
+    in.seekg(0);
+    if (!in.read(&r[0], static_cast<std::streamsize>(r.size())))
+        throw std::runtime_error("Error reading " + fname.string() + ".");
+    return r;
+}
+
+LoadedCompileCommands synth::loadCompileCommands(
+    fs::path const& fname, CompileCommandFilter const& keep)
+{
+    std::string const json = readFile(fname);
+    char const* const end = json.data() + json.size();
+    LoadedCompileCommands r;
+    // Hash -> index in r.cmds.
+    std::unordered_multimap<std::size_t, std::size_t> cmdsByHash;
+    try {
+        JsonReader in(json.data(), end);
+        in.expect('[');
+        if (!in.consume(']')) {
+            do {
+                ++r.nEntries;
+                RawCompileCommand raw = readRawCommand(in);
+                if (!keep(raw.cmd)) {
+                    ++r.nFiltered;
+                    continue;
+                }
+                readArgs(raw, end);
+                std::size_t h = hashCommand(raw.cmd);
+                auto sameHash = cmdsByHash.equal_range(h);
+                if (std::any_of(sameHash.first, sameHash.second,
+                    [&](std::pair<std::size_t const, std::size_t> const& e) {
+                        return isSameCommand(r.cmds[e.second], raw.cmd);
+                    })
+                ) {
+                    ++r.nDuplicates;
+                    continue;
+                }
+                cmdsByHash.emplace(h, r.cmds.size());
+                r.cmds.push_back(std::move(raw.cmd));
+            } while (in.consume(','));
+            in.expect(']');
+        }
+        if (!in.atEnd())
+            in.fail("Trailing data");
+    } catch (std::runtime_error const& e) {
+        throw std::runtime_error(
+            fname.string() + ", entry " + std::to_string(r.nEntries) + ": "
+            + e.what());
+    }
+    return r;
+}
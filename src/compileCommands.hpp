@@ -0,0 +1,47 @@
+#ifndef SYNTH_COMPILECOMMANDS_HPP_INCLUDED
+#define SYNTH_COMPILECOMMANDS_HPP_INCLUDED
+
+#include <boost/filesystem/path.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace synth {
+
+namespace fs = boost::filesystem;
+
+// An entry of a compile_commands.json, read without libclang.
+struct CompileCommand {
+    std::string directory;
+    std::string file; // As given, i.e. possibly relative to directory.
+    std::vector<std::string> args; // Including the compiler.
+};
+
+// Parses a compile_commands.json entry, i.e. a JSON object with "directory",
+// "file" and either "arguments" or "command" (which is split like a shell
+// would), that spans all of [begin, end) except for whitespace. Like clang,
+// compiler wrappers such as ccache are removed from the arguments. Throws
+// std::runtime_error if the entry is malformed.
+CompileCommand parseCompileCommand(char const* begin, char const* end);
+
+// Decides whether to load an entry. Only directory and file are set yet.
+using CompileCommandFilter = std::function<bool(CompileCommand const&)>;
+
+struct LoadedCompileCommands {
+    std::vector<CompileCommand> cmds;
+    unsigned nEntries = 0;
+    unsigned nFiltered = 0; // Rejected by the filter.
+    unsigned nDuplicates = 0; // Equal to an earlier entry in cmds.
+};
+
+// Loads a compile_commands.json in a single pass, splitting or copying the
+// arguments only of the entries that keep accepts and dropping duplicates,
+// so that a huge database of which only a few entries are needed loads fast.
+// Throws std::runtime_error if the file is unreadable or malformed.
+LoadedCompileCommands loadCompileCommands(
+    fs::path const& fname, CompileCommandFilter const& keep);
+
+} // namespace synth
+
+#endif // SYNTH_COMPILECOMMANDS_HPP_INCLUDED
@@ -0,0 +1,335 @@
+#include "forkedWorkers.hpp"
+
+#include "IncludeGraph.hpp"
+#include "Metrics.hpp"
+#include "MultiTuProcessor.hpp"
+#include "ProgressReporter.hpp"
+#include "Tracer.hpp"
+#include "annotate.hpp"
+#include "cgWrappers.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#   include <poll.h>
+#   include <signal.h>
+#   include <sys/types.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+#endif
+
+using namespace synth;
+
+#ifdef _WIN32
+
+void synth::processInWorkerProcesses(
+    std::vector<CompileCommand> const&,
+    std::vector<unsigned> const&,
+    std::vector<char const*> const&,
+    MultiTuProcessor&,
+    WorkerProcessOptions const&,
+    ProgressReporter&)
+{
+    throw std::runtime_error("--fork is not supported on this platform.");
+}
+
+#else
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct PendingTu {
+    unsigned cmdIdx;
+    bool skipFunctionBodies;
+};
+
+struct Worker {
+    pid_t pid;
+    int fd; // Read end of the pipe the result is sent through.
+    PendingTu tu;
+    unsigned slot;
+    Clock::time_point deadline;
+    std::string result;
+};
+
+} // anonymous namespace
+
+static std::runtime_error systemError(char const* what)
+{
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+static void writeAll(int fd, char const* data, std::size_t sz)
+{
+    while (sz > 0) {
+        ssize_t n = write(fd, data, sz);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw systemError("Error sending result");
+        }
+        data += n;
+        sz -= static_cast<std::size_t>(n);
+    }
+}
+
+// Runs in the child process. Returns its exit code.
+static int runWorker(
+    CompileCommand const& cmd,
+    std::vector<char const*> const& extraArgs,
+    MultiTuProcessor& state,
+    bool skipFunctionBodies,
+    int fd)
+{
+    if (!cmd.directory.empty())
+        fs::current_path(cmd.directory);
+
+    std::vector<char const*> args;
+    args.reserve(cmd.args.size() + extraArgs.size());
+    for (std::string const& arg : cmd.args)
+        args.push_back(arg.c_str());
+    args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+
+    // Spans recorded here would never reach the parent's trace file.
+    state.setTracer(nullptr);
+    Metrics metrics;
+    state.setMetrics(&metrics);
+    // Only this TU's inclusions are sent back.
+    IncludeGraph includeGraph;
+    if (state.includeGraph())
+        state.setIncludeGraph(&includeGraph);
+    state.startRecording();
+    CgIdxHandle cidx(clang_createIndex(
+        /*excludeDeclarationsFromPCH:*/ true,
+        /*displayDiagnostics:*/ true));
+    ProcessTuOptions opts;
+    opts.skipFunctionBodies = skipFunctionBodies;
+    // E.g. another configuration of an already processed file.
+    opts.scanFirst = !skipFunctionBodies && !cmd.file.empty()
+        && state.isFileProcessed(cmd.file);
+    int r = processTu(
+        cidx.get(), state, args.data(), static_cast<int>(args.size()), opts);
+    if (r != EXIT_SUCCESS)
+        return r;
+
+    std::string result;
+    std::uint64_t nTokens = metrics.tokens;
+    result.append(reinterpret_cast<char const*>(&nTokens), sizeof(nTokens));
+    state.writeRecordedResult(result);
+    writeAll(fd, result.data(), result.size());
+    return EXIT_SUCCESS;
+}
+
+static Worker startWorker(
+    PendingTu tu,
+    unsigned slot,
+    std::vector<CompileCommand> const& cmds,
+    std::vector<char const*> const& extraArgs,
+    MultiTuProcessor& state,
+    unsigned timeoutSecs)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw systemError("Error creating pipe");
+
+    // Otherwise, buffered output would be written by both processes.
+    std::cout.flush();
+    std::clog.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        throw systemError("Error forking worker process");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int r;
+        try {
+            r = runWorker(
+                cmds[tu.cmdIdx],
+                extraArgs,
+                state,
+                tu.skipFunctionBodies,
+                fds[1]);
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << '\n';
+            r = EXIT_FAILURE;
+        }
+        std::cout.flush();
+        std::clog.flush();
+        _exit(r); // Destructors and atexit handlers belong to the parent.
+    }
+    close(fds[1]);
+
+    Worker w {pid, fds[0], tu, slot, Clock::time_point::max(), std::string()};
+    if (timeoutSecs != 0)
+        w.deadline = Clock::now() + std::chrono::seconds(timeoutSecs);
+    return w;
+}
+
+// Reaps w and merges its result into state. Returns processTu()'s result for
+// it (kTuTimedOut if it was killed).
+static int finishWorker(
+    Worker& w, bool killed, std::string const& tuName, MultiTuProcessor& state)
+{
+    close(w.fd);
+    if (killed)
+        kill(w.pid, SIGKILL);
+    int status;
+    while (waitpid(w.pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            throw systemError("Error waiting for worker process");
+    }
+
+    if (killed) {
+        std::clog << "Time budget exceeded, killed worker for " << tuName
+                  << '\n';
+        return kTuTimedOut;
+    }
+    if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        std::cerr << "Worker for " << tuName << " was terminated by signal "
+                  << sig << " (" << strsignal(sig) << ").\n";
+        return EXIT_FAILURE;
+    }
+    int r = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+    if (r != EXIT_SUCCESS)
+        return r;
+
+    TraceSpan mergeSpan(state.tracer(), "mergeResult");
+    if (mergeSpan.enabled())
+        mergeSpan.addArg("tu", tuName);
+    std::uint64_t nTokens;
+    try {
+        if (w.result.size() < sizeof(nTokens))
+            throw std::runtime_error("Truncated data.");
+        std::memcpy(&nTokens, w.result.data(), sizeof(nTokens));
+        state.mergeResult(
+            w.result.data() + sizeof(nTokens),
+            w.result.size() - sizeof(nTokens));
+    } catch (std::runtime_error const& e) {
+        std::cerr << "Discarding result of worker for " << tuName << ": "
+                  << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    if (Metrics* metrics = state.metrics())
+        metrics->tokens += nTokens;
+    return EXIT_SUCCESS;
+}
+
+void synth::processInWorkerProcesses(
+    std::vector<CompileCommand> const& cmds,
+    std::vector<unsigned> const& cmdIndices,
+    std::vector<char const*> const& extraArgs,
+    MultiTuProcessor& state,
+    WorkerProcessOptions const& opts,
+    ProgressReporter& progress)
+{
+    Metrics* metrics = state.metrics();
+    std::size_t nextCmd = 0;
+    std::vector<Worker> workers;
+    std::vector<bool> slotsUsed(opts.nJobs);
+    auto const tuName = [&cmds](unsigned cmdIdx) {
+        return cmds[cmdIdx].file;
+    };
+
+    // Wait for all children, even if an error occurs in between.
+    struct WorkerKiller {
+        std::vector<Worker>& workers;
+        ~WorkerKiller() {
+            for (Worker& w : workers) {
+                close(w.fd);
+                kill(w.pid, SIGKILL);
+                waitpid(w.pid, nullptr, 0);
+            }
+        }
+    } killer {workers};
+
+    for (;;) {
+        // Commands for files outside the input directories were already
+        // dropped (and counted) by loadCompileCommands().
+        while (workers.size() < opts.nJobs && nextCmd < cmdIndices.size()) {
+            PendingTu tu {cmdIndices[nextCmd++], false};
+            unsigned slot = static_cast<unsigned>(
+                std::find(slotsUsed.begin(), slotsUsed.end(), false)
+                - slotsUsed.begin());
+            workers.push_back(startWorker(
+                tu, slot, cmds, extraArgs, state, opts.timeoutSecs));
+            slotsUsed[slot] = true;
+            progress.begin(slot, tu.cmdIdx);
+        }
+        if (workers.empty())
+            break;
+
+        std::vector<pollfd> fds;
+        fds.reserve(workers.size());
+        Clock::time_point nextDeadline = Clock::time_point::max();
+        for (Worker const& w : workers) {
+            fds.push_back({w.fd, POLLIN, 0});
+            nextDeadline = std::min(nextDeadline, w.deadline);
+        }
+        int timeoutMs = -1;
+        if (nextDeadline != Clock::time_point::max()) {
+            auto remaining = std::chrono::duration_cast<
+                std::chrono::milliseconds>(nextDeadline - Clock::now());
+            timeoutMs = remaining.count() < 0
+                ? 0 : static_cast<int>(remaining.count()) + 1;
+        }
+        if (poll(fds.data(), fds.size(), timeoutMs) < 0 && errno != EINTR)
+            throw systemError("Error waiting for worker processes");
+
+        auto const now = Clock::now();
+        for (std::size_t i = workers.size(); i-- > 0;) {
+            Worker& w = workers[i];
+            bool done = false;
+            if (fds[i].revents != 0) {
+                char buf[64 * 1024];
+                ssize_t n = read(w.fd, buf, sizeof(buf));
+                if (n > 0)
+                    w.result.append(buf, static_cast<std::size_t>(n));
+                else
+                    done = n == 0 || errno != EINTR;
+            }
+            bool killed = !done && now >= w.deadline;
+            if (!done && !killed)
+                continue;
+
+            int r = finishWorker(w, killed, tuName(w.tu.cmdIdx), state);
+            if (r == kTuTimedOut && opts.retryCheaper
+                && !w.tu.skipFunctionBodies
+            ) {
+                std::clog << "Retrying with function bodies skipped.\n";
+                w = startWorker(
+                    {w.tu.cmdIdx, true},
+                    w.slot,
+                    cmds,
+                    extraArgs,
+                    state,
+                    opts.timeoutSecs);
+                progress.begin(w.slot, w.tu.cmdIdx);
+                continue;
+            }
+            if (metrics)
+                metrics->countTuResult(r);
+            progress.end(w.slot);
+            slotsUsed[w.slot] = false;
+            workers.erase(workers.begin() + static_cast<std::ptrdiff_t>(i));
+            // Only after w is gone, so that if this throws, the killer only
+            // sees the children that still run.
+            state.writeFinishedFiles();
+        }
+    }
+}
+
+#endif // _WIN32
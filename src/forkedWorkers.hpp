@@ -0,0 +1,37 @@
+#ifndef SYNTH_FORKEDWORKERS_HPP_INCLUDED
+#define SYNTH_FORKEDWORKERS_HPP_INCLUDED
+
+#include "compileCommands.hpp"
+
+#include <vector>
+
+namespace synth {
+
+class MultiTuProcessor;
+class ProgressReporter;
+
+struct WorkerProcessOptions {
+    unsigned nJobs;
+    unsigned timeoutSecs; // 0: Unlimited.
+    bool retryCheaper; // Retry timed out TUs with function bodies skipped.
+};
+
+// Processes each of the commands cmds[cmdIndices[i]] in a child process forked
+// from this one, running at most opts.nJobs at a time. The children send what
+// they added to their copy of state back through a pipe and it is merged into
+// state here, so a crash or hang in libclang only loses the affected
+// translation unit. Children that exceed opts.timeoutSecs are killed. Uses
+// slots [0, opts.nJobs) of progress. The commands must already be restricted
+// to main files in state's input directories. Must be called while no other
+// thread uses state.
+void processInWorkerProcesses(
+    std::vector<CompileCommand> const& cmds,
+    std::vector<unsigned> const& cmdIndices,
+    std::vector<char const*> const& extraArgs,
+    MultiTuProcessor& state,
+    WorkerProcessOptions const& opts,
+    ProgressReporter& progress);
+
+} // namespace synth
+
+#endif // SYNTH_FORKEDWORKERS_HPP_INCLUDED
@@ -0,0 +1,336 @@
+// Generates a synthetic C or C++ project together with a
+// compile_commands.json for testing how synth scales. The output only depends
+// on the options (including the seed), not on the platform.
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct CorpusOptions {
+    char const* outDir;
+    std::uint32_t seed;
+    unsigned nFiles; // Translation units.
+    unsigned nHeaders; // Per include level.
+    unsigned fanout; // #includes per file.
+    unsigned depth; // Include levels.
+    unsigned percentTemplates;
+    unsigned percentComments;
+    unsigned linesPerFile; // Approximate.
+    bool isC;
+};
+
+// std::uniform_int_distribution is implementation defined, but std::mt19937
+// is not, so this is used to get the same corpus on all platforms.
+class Rng {
+public:
+    explicit Rng(std::uint32_t seed)
+        : m_engine(seed)
+    { }
+
+    // Returns a number in [0, n).
+    unsigned below(unsigned n)
+    {
+        return n == 0 ? 0 : static_cast<unsigned>(m_engine() % n);
+    }
+
+    bool percent(unsigned p) { return below(100) < p; }
+
+private:
+    std::mt19937 m_engine;
+};
+
+} // anonymous namespace
+
+static std::string headerName(unsigned level, unsigned idx)
+{
+    return "h" + std::to_string(level) + "_" + std::to_string(idx) + ".h";
+}
+
+static std::string symbolSuffix(std::string const& unit, unsigned idx)
+{
+    std::string r = unit;
+    for (char& c : r) {
+        if (c == '.')
+            c = '_';
+    }
+    return r + "_" + std::to_string(idx);
+}
+
+static void writeComment(std::string& out, Rng& rng)
+{
+    static char const* const kWords[] = {
+        "the", "value", "returns", "computes", "buffer", "index", "TODO",
+        "note", "handle", "state", "if", "is", "not", "empty", "cache"};
+    bool block = rng.percent(30);
+    out += block ? "/* " : "// ";
+    unsigned nWords = 3 + rng.below(12);
+    for (unsigned i = 0; i < nWords; ++i) {
+        out += kWords[rng.below(sizeof(kWords) / sizeof(kWords[0]))];
+        out += ' ';
+    }
+    out += block ? "*/\n" : "\n";
+}
+
+// Appends one top-level entity (struct, function, template, ...) named after
+// sfx and returns the number of lines written. callees are functions declared
+// in included headers that may be called.
+static unsigned writeEntity(
+    std::string& out,
+    std::string const& sfx,
+    std::vector<std::string> const& callees,
+    bool isHeader,
+    CorpusOptions const& opts,
+    Rng& rng)
+{
+    if (rng.percent(opts.percentComments))
+        writeComment(out, rng);
+    if (!opts.isC && rng.percent(opts.percentTemplates)) {
+        out += "template <typename T, int N = " + std::to_string(rng.below(64))
+            + ">\nstruct Tpl" + sfx + " {\n"
+            "    T values[N];\n"
+            "    T get(int i) const { return values[i % N]; }\n"
+            "    template <typename U> U as() const"
+            " { return static_cast<U>(values[0]); }\n"
+            "};\n";
+        return 6;
+    }
+    switch (rng.below(3)) {
+        case 0:
+            out += "struct S" + sfx + " {\n"
+                "    int count;\n"
+                "    double ratio;\n"
+                "    char const* name;\n"
+                "};\n";
+            if (!opts.isC)
+                out += "using Alias" + sfx + " = S" + sfx + ";\n";
+            else
+                out += "typedef struct S" + sfx + " S" + sfx + ";\n";
+            return 6;
+        case 1:
+            out += "enum E" + sfx + " { E" + sfx + "_a, E" + sfx + "_b = 0x"
+                + std::to_string(rng.below(100)) + " };\n";
+            return 1;
+        default: {
+            std::string decl = "int f" + sfx + "(int a, char const* s)";
+            if (isHeader) {
+                out += decl + ";\n";
+                return 1;
+            }
+            out += decl + "\n{\n"
+                "    int r = a * " + std::to_string(rng.below(1000)) + ";\n";
+            unsigned nCalls = callees.empty() ? 0 : 1 + rng.below(3);
+            for (unsigned i = 0; i < nCalls; ++i) {
+                out += "    r += "
+                    + callees[rng.below(static_cast<unsigned>(callees.size()))]
+                    + "(r, \"literal " + std::to_string(i) + "\");\n";
+            }
+            out += "    return s ? r : -1;\n}\n";
+            return 5 + nCalls;
+        }
+    }
+}
+
+// Writes the body of a file and returns the functions it declares.
+static std::vector<std::string> writeBody(
+    std::string& out,
+    std::string const& unit,
+    std::vector<std::string> const& callees,
+    bool isHeader,
+    CorpusOptions const& opts,
+    Rng& rng)
+{
+    std::vector<std::string> functions;
+    if (!opts.isC)
+        out += "namespace corpus {\n\n";
+    unsigned nLines = 0;
+    for (unsigned i = 0; nLines < opts.linesPerFile; ++i) {
+        std::string sfx = symbolSuffix(unit, i);
+        std::size_t oldSz = out.size();
+        nLines += writeEntity(out, sfx, callees, isHeader, opts, rng);
+        if (out.find("int f" + sfx, oldSz) != std::string::npos)
+            functions.push_back((opts.isC ? "f" : "corpus::f") + sfx);
+        out += '\n';
+        ++nLines;
+    }
+    if (!opts.isC)
+        out += "} // namespace corpus\n";
+    return functions;
+}
+
+static void writeFile(fs::path const& p, std::string const& contents)
+{
+    fs::ofstream f(p, std::ios::binary);
+    f.exceptions(std::ios::badbit | std::ios::failbit);
+    f << contents;
+}
+
+static std::string jsonString(std::string const& s)
+{
+    std::string r = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            r += '\\';
+        r += c;
+    }
+    r += '"';
+    return r;
+}
+
+static void generate(CorpusOptions const& opts)
+{
+    fs::path const root = fs::absolute(opts.outDir);
+    fs::path const incDir = root / "include";
+    fs::path const srcDir = root / "src";
+    fs::create_directories(incDir);
+    fs::create_directories(srcDir);
+    Rng rng(opts.seed);
+
+    // Headers of level l include headers of level l + 1. Translation units
+    // include level 0 headers and call the functions declared there.
+    std::vector<std::vector<std::string>> level0Functions(opts.nHeaders);
+    for (unsigned level = opts.depth; level-- > 0;) {
+        for (unsigned idx = 0; idx < opts.nHeaders; ++idx) {
+            std::string name = headerName(level, idx);
+            std::string guard = "CORPUS_" + symbolSuffix(name, 0);
+            std::string out =
+                "#ifndef " + guard + "\n#define " + guard + "\n\n";
+            if (level + 1 < opts.depth) {
+                for (unsigned i = 0; i < opts.fanout; ++i) {
+                    unsigned incIdx = rng.below(opts.nHeaders);
+                    out += "#include \"" + headerName(level + 1, incIdx)
+                        + "\"\n";
+                }
+                out += '\n';
+            }
+            std::vector<std::string> functions = writeBody(
+                out, name, {}, /*isHeader=*/ true, opts, rng);
+            if (level == 0)
+                level0Functions[idx] = std::move(functions);
+            out += "\n#endif // " + guard + "\n";
+            writeFile(incDir / name, out);
+        }
+    }
+
+    std::string const ext = opts.isC ? ".c" : ".cpp";
+    std::string db = "[";
+    for (unsigned fileIdx = 0; fileIdx < opts.nFiles; ++fileIdx) {
+        std::string name = "file" + std::to_string(fileIdx) + ext;
+        std::string out;
+        std::vector<std::string> callees;
+        if (opts.depth > 0) {
+            for (unsigned i = 0; i < opts.fanout; ++i) {
+                unsigned incIdx = rng.below(opts.nHeaders);
+                out += "#include \"" + headerName(0, incIdx) + "\"\n";
+                callees.insert(
+                    callees.end(),
+                    level0Functions[incIdx].begin(),
+                    level0Functions[incIdx].end());
+            }
+            out += '\n';
+        }
+        writeBody(out, name, callees, /*isHeader=*/ false, opts, rng);
+        fs::path const srcPath = srcDir / name;
+        writeFile(srcPath, out);
+
+        db += fileIdx == 0 ? "\n" : ",\n";
+        db += "  {\"directory\": " + jsonString(root.string())
+            + ", \"file\": " + jsonString(srcPath.string())
+            + ", \"arguments\": [" + jsonString(opts.isC ? "cc" : "c++")
+            + ", " + jsonString(opts.isC ? "-std=c99" : "-std=c++14")
+            + ", " + jsonString("-I" + incDir.string())
+            + ", \"-c\", " + jsonString(srcPath.string()) + "]}";
+    }
+    db += "\n]\n";
+    writeFile(root / "compile_commands.json", db);
+}
+
+static unsigned parseUint(char const* opt, char const* val)
+{
+    char* end;
+    unsigned long n = std::strtoul(val, &end, 10);
+    if (*end || !*val)
+        throw std::runtime_error(std::string("Integer expected for ") + opt);
+    return static_cast<unsigned>(n);
+}
+
+static void printUsage()
+{
+    std::cerr <<
+        "Usage: synth-gencorpus -o <outdir> [--seed <n>] [--files <n>]\n"
+        "         [--headers <n>] [--fanout <n>] [--depth <n>]\n"
+        "         [--templates <percent>] [--comments <percent>]\n"
+        "         [--lines <n>] [--c]\n";
+}
+
+int main(int argc, char* argv[])
+{
+    CorpusOptions opts {
+        nullptr,
+        /*seed=*/ 1,
+        /*nFiles=*/ 100,
+        /*nHeaders=*/ 20,
+        /*fanout=*/ 4,
+        /*depth=*/ 3,
+        /*percentTemplates=*/ 20,
+        /*percentComments=*/ 30,
+        /*linesPerFile=*/ 200,
+        /*isC=*/ false};
+    try {
+        for (int i = 1; i < argc; ++i) {
+            char const* opt = argv[i];
+            if (!std::strcmp(opt, "--c")) {
+                opts.isC = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+            char const* val = argv[++i];
+            if (!std::strcmp(opt, "-o")) {
+                opts.outDir = val;
+            } else if (!std::strcmp(opt, "--seed")) {
+                opts.seed = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--files")) {
+                opts.nFiles = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--headers")) {
+                opts.nHeaders = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--fanout")) {
+                opts.fanout = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--depth")) {
+                opts.depth = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--templates")) {
+                opts.percentTemplates = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--comments")) {
+                opts.percentComments = parseUint(opt, val);
+            } else if (!std::strcmp(opt, "--lines")) {
+                opts.linesPerFile = parseUint(opt, val);
+            } else {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+        }
+        if (!opts.outDir) {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+        if (opts.nHeaders == 0)
+            opts.depth = 0;
+        generate(opts);
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
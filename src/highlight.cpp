@@ -1,6 +1,7 @@
 #include "highlight.hpp"
 
 #include "CgStr.hpp"
+#include "CursorCache.hpp"
 #include "config.hpp"
 #include "debug.hpp"
 
@@ -12,64 +13,249 @@ using namespace synth;
 
 unsigned const kMaxRefRecursion = 16;
 
+namespace {
+
+// Token spellings {{{
+
+struct SpellingEntry {
+    char const* spelling;
+    SpellingClass cls;
+    bool typePrefix; // Also matches if followed by a space, e.g. "unsigned "
+};
+
+constexpr SpellingEntry kSpellings[] = {
+    {"unsigned", SpellingClass::builtinType, true},
+    {"signed", SpellingClass::builtinType, true},
+    {"short", SpellingClass::builtinType, true},
+    {"long", SpellingClass::builtinType, true},
+    {"int", SpellingClass::builtinType, false},
+    {"float", SpellingClass::builtinType, false},
+    {"double", SpellingClass::builtinType, false},
+    {"bool", SpellingClass::builtinType, false},
+    {"char", SpellingClass::builtinType, false},
+    {"char16_t", SpellingClass::builtinType, false},
+    {"char32_t", SpellingClass::builtinType, false},
+    {"wchar_t", SpellingClass::builtinType, false},
+    {"void", SpellingClass::builtinType, false},
+    {"sizeof", SpellingClass::opWord, false},
+    {"alignof", SpellingClass::opWord, false},
+    {"this", SpellingClass::kwThis, false},
+    {"operator", SpellingClass::kwOperator, false},
+    {"include", SpellingClass::ppInclude, false},
+    {"#", SpellingClass::ppInclude, false},
+    {"(", SpellingClass::openParen, false},
+    {"[", SpellingClass::openParen, false},
+    {"{", SpellingClass::declPunct, false},
+    {";", SpellingClass::declPunct, false}
+};
+
+std::size_t const kNSpellings = sizeof(kSpellings) / sizeof(kSpellings[0]);
+
+// Must be a power of two.
+std::size_t const kSpellingTableSz = 128;
+
+constexpr std::size_t cstrLen(char const* s)
+{
+    std::size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+constexpr std::size_t charValue(char c)
+{
+    return static_cast<unsigned char>(c);
+}
+
+// Perfect for kSpellings (checked when building kSpellingTable).
+constexpr std::size_t spellingHash(char const* s, std::size_t n)
+{
+    return (charValue(s[0]) + charValue(s[n / 2]) + charValue(s[n - 1]))
+        & (kSpellingTableSz - 1);
+}
+
+struct SpellingTable {
+    // Index into kSpellings plus one; zero means empty.
+    unsigned char slots[kSpellingTableSz];
+};
+
+constexpr SpellingTable makeSpellingTable()
+{
+    SpellingTable t {};
+    for (std::size_t i = 0; i < kNSpellings; ++i) {
+        char const* sp = kSpellings[i].spelling;
+        std::size_t h = spellingHash(sp, cstrLen(sp));
+        if (t.slots[h] != 0)
+            throw "spellingHash() has a collision."; // Compile-time error.
+        t.slots[h] = static_cast<unsigned char>(i + 1);
+    }
+    return t;
+}
+
+constexpr SpellingTable kSpellingTable = makeSpellingTable();
+
+SpellingEntry const* lookupSpelling(boost::string_ref sp)
+{
+    if (sp.empty())
+        return nullptr;
+    unsigned char slot = kSpellingTable.slots[
+        spellingHash(sp.data(), sp.size())];
+    if (slot == 0)
+        return nullptr;
+    SpellingEntry const& e = kSpellings[slot - 1];
+    return sp == e.spelling ? &e : nullptr;
+}
+
+// }}}
+
+// Cursor kinds {{{
+
+// Cursor kinds above this are not classified (i.e. treated like unexposed).
+std::size_t const kCursorKindTableSz = 1024;
+
+enum CursorKindFlags : unsigned char {
+    kindIsType = 1 << 0, // Including type aliases.
+    kindIsTypeAlias = 1 << 1,
+    kindIsFunction = 1 << 2
+};
+
+constexpr CXCursorKind kTypeAliasKinds[] = {
+    CXCursor_TypeAliasDecl,
+    CXCursor_TypeAliasTemplateDecl,
+    CXCursor_TypedefDecl
+};
+
+constexpr CXCursorKind kTypeKinds[] = {
+    CXCursor_ClassDecl,
+    CXCursor_ClassTemplate,
+    CXCursor_ClassTemplatePartialSpecialization,
+    CXCursor_StructDecl,
+    CXCursor_UnionDecl,
+    CXCursor_EnumDecl,
+    CXCursor_ObjCInterfaceDecl,
+    CXCursor_ObjCCategoryDecl,
+    CXCursor_ObjCProtocolDecl,
+    CXCursor_ObjCImplementationDecl,
+    CXCursor_TemplateTypeParameter,
+    CXCursor_TemplateTemplateParameter,
+    CXCursor_TypeRef,
+    CXCursor_ObjCSuperClassRef,
+    CXCursor_ObjCProtocolRef,
+    CXCursor_ObjCClassRef,
+    CXCursor_CXXBaseSpecifier
+};
+
+constexpr CXCursorKind kFunctionKinds[] = {
+    CXCursor_FunctionDecl,
+    CXCursor_ObjCInstanceMethodDecl,
+    CXCursor_ObjCClassMethodDecl,
+    CXCursor_CXXMethod,
+    CXCursor_FunctionTemplate,
+    CXCursor_Constructor,
+    CXCursor_Destructor,
+    CXCursor_ConversionFunction,
+    CXCursor_OverloadedDeclRef
+};
+
+// Identifiers with these cursor kinds get a fixed highlighting.
+struct IdentifierKindAttrs {
+    CXCursorKind kind;
+    TokenAttributes attrs;
+};
+
+constexpr IdentifierKindAttrs kIdentifierKindAttrs[] = {
+    {CXCursor_ObjCPropertyDecl, TokenAttributes::varNonstaticMember}, // Sorta.
+    {CXCursor_ObjCIvarDecl, TokenAttributes::varNonstaticMember},
+    {CXCursor_FieldDecl, TokenAttributes::varNonstaticMember}, // TODO
+    {CXCursor_EnumConstantDecl, TokenAttributes::constant},
+    {CXCursor_NonTypeTemplateParameter, TokenAttributes::constant},
+    {CXCursor_ParmDecl, TokenAttributes::varLocal},
+    {CXCursor_Namespace, TokenAttributes::namesp},
+    {CXCursor_NamespaceAlias, TokenAttributes::namesp},
+    {CXCursor_UsingDirective, TokenAttributes::namesp},
+    {CXCursor_NamespaceRef, TokenAttributes::namesp},
+    {CXCursor_LabelStmt, TokenAttributes::lbl}
+};
+
+struct CursorKindTable {
+    unsigned char flags[kCursorKindTableSz];
+
+    // TokenAttributes::none if not fixed (see kIdentifierKindAttrs).
+    TokenAttributes identifierAttrs[kCursorKindTableSz];
+};
+
+template <std::size_t N>
+constexpr void addKindFlags(
+    CursorKindTable& t, CXCursorKind const (&kinds)[N], unsigned char flags)
+{
+    for (std::size_t i = 0; i < N; ++i)
+        t.flags[kinds[i]] |= flags;
+}
+
+constexpr CursorKindTable makeCursorKindTable()
+{
+    CursorKindTable t {};
+    addKindFlags(t, kTypeAliasKinds, kindIsType | kindIsTypeAlias);
+    addKindFlags(t, kTypeKinds, kindIsType);
+    addKindFlags(t, kFunctionKinds, kindIsFunction);
+
+    for (std::size_t k = 0; k < kCursorKindTableSz; ++k) {
+        if (t.flags[k] & kindIsType)
+            t.identifierAttrs[k] = TokenAttributes::ty;
+        else if (t.flags[k] & kindIsFunction)
+            t.identifierAttrs[k] = TokenAttributes::func;
+    }
+    for (auto const& ka : kIdentifierKindAttrs)
+        t.identifierAttrs[ka.kind] = ka.attrs;
+    return t;
+}
+
+constexpr CursorKindTable kCursorKindTable = makeCursorKindTable();
+
+unsigned char cursorKindFlags(CXCursorKind k)
+{
+    auto idx = static_cast<std::size_t>(k);
+    return idx < kCursorKindTableSz ? kCursorKindTable.flags[idx] : 0;
+}
+
+TokenAttributes identifierKindAttrs(CXCursorKind k)
+{
+    auto idx = static_cast<std::size_t>(k);
+    return idx < kCursorKindTableSz
+        ? kCursorKindTable.identifierAttrs[idx] : TokenAttributes::none;
+}
+
+// }}}
+
+} // anonymous namespace
+
+SpellingClass synth::classifySpelling(boost::string_ref sp)
+{
+    std::size_t spacePos = sp.find(' ');
+    if (spacePos == boost::string_ref::npos) {
+        SpellingEntry const* e = lookupSpelling(sp);
+        return e ? e->cls : SpellingClass::other;
+    }
+    SpellingEntry const* e = lookupSpelling(sp.substr(0, spacePos));
+    return e && e->typePrefix ? e->cls : SpellingClass::other;
+}
+
 bool synth::isTypeAliasCursorKind(CXCursorKind k)
 {
-    return k == CXCursor_TypeAliasDecl
-        || k == CXCursor_TypeAliasTemplateDecl
-        || k == CXCursor_TypedefDecl;
+    return (cursorKindFlags(k) & kindIsTypeAlias) != 0;
 }
 
 bool synth::isTypeCursorKind(CXCursorKind k)
 {
-    SYNTH_DISCLANGWARN_BEGIN("-Wswitch-enum")
-    switch (k) {
-        case CXCursor_ClassDecl:
-        case CXCursor_ClassTemplate:
-        case CXCursor_ClassTemplatePartialSpecialization:
-        case CXCursor_StructDecl:
-        case CXCursor_UnionDecl:
-        case CXCursor_EnumDecl:
-        case CXCursor_ObjCInterfaceDecl:
-        case CXCursor_ObjCCategoryDecl:
-        case CXCursor_ObjCProtocolDecl:
-        case CXCursor_ObjCImplementationDecl:
-        case CXCursor_TemplateTypeParameter:
-        case CXCursor_TemplateTemplateParameter:
-        case CXCursor_TypeRef:
-        case CXCursor_ObjCSuperClassRef:
-        case CXCursor_ObjCProtocolRef:
-        case CXCursor_ObjCClassRef:
-        case CXCursor_CXXBaseSpecifier:
-            return true;
-
-        default:
-            return isTypeAliasCursorKind(k);
-    }
-    SYNTH_DISCLANGWARN_END
+    return (cursorKindFlags(k) & kindIsType) != 0;
 }
 
 bool synth::isFunctionCursorKind(CXCursorKind k)
 {
-    SYNTH_DISCLANGWARN_BEGIN("-Wswitch-enum")
-    switch (k) {
-        case CXCursor_FunctionDecl:
-        case CXCursor_ObjCInstanceMethodDecl:
-        case CXCursor_ObjCClassMethodDecl:
-        case CXCursor_CXXMethod:
-        case CXCursor_FunctionTemplate:
-        case CXCursor_Constructor:
-        case CXCursor_Destructor:
-        case CXCursor_ConversionFunction:
-        case CXCursor_OverloadedDeclRef:
-            return true;
-
-        default:
-            return false;
-    }
-    SYNTH_DISCLANGWARN_END
+    return (cursorKindFlags(k) & kindIsFunction) != 0;
 }
 
-static TokenAttributes getVarTokenAttributes(CXCursor cur)
+TokenAttributes synth::getVarTokenAttributes(CXCursor cur)
 {
     if (clang_getCursorLinkage(cur) == CXLinkage_NoLinkage)
         return TokenAttributes::varLocal;
@@ -80,7 +266,7 @@ static TokenAttributes getVarTokenAttributes(CXCursor cur)
     return TokenAttributes::varNonstaticMember;
 }
 
-static TokenAttributes getIntTokenAttributes(boost::string_ref sp)
+TokenAttributes synth::getIntTokenAttributes(boost::string_ref sp)
 {
     if (!sp.empty()) {
         if (sp.size() >= 2 && sp[0] == '0') {
@@ -97,38 +283,21 @@ static TokenAttributes getIntTokenAttributes(boost::string_ref sp)
     return TokenAttributes::litNum;
 }
 
-static bool isBuiltinTypeKw(boost::string_ref t) {
-    return t.starts_with("unsigned ")
-        || t == "unsigned"
-        || t.starts_with("signed ")
-        || t == "signed"
-        || t.starts_with("short ")
-        || t == "short"
-        || t.starts_with("long ")
-        || t == "long"
-        || t == "int"
-        || t == "float"
-        || t == "double"
-        || t == "bool"
-        || t == "char"
-        || t == "char16_t"
-        || t == "char32_t"
-        || t == "wchar_t"
-        || t == "void";
-}
 static TokenAttributes getTokenAttributesImpl(
-    CXToken tok,
+    CXTokenKind tk,
     CXCursor cur,
     boost::string_ref sp, // token spelling
-    CXTranslationUnit tu,
+    CursorCache& cache,
     unsigned recursionDepth)
 {
     CXCursorKind k = clang_getCursorKind(cur);
-    CXTokenKind tk = clang_getTokenKind(tok);
 
     if (clang_isPreprocessing(k)) {
-        if (k == CXCursor_InclusionDirective && sp != "include" && sp != "#")
+        if (k == CXCursor_InclusionDirective
+            && classifySpelling(sp) != SpellingClass::ppInclude
+        ) {
             return TokenAttributes::preIncludeFile;
+        }
         return TokenAttributes::pre;
     }
 
@@ -169,86 +338,59 @@ static TokenAttributes getTokenAttributesImpl(
             ) {
                 return TokenAttributes::litKw;
             }
-            if (k == CXCursor_TypeRef || isBuiltinTypeKw(sp))
+            SpellingClass spCls = classifySpelling(sp);
+            if (k == CXCursor_TypeRef || spCls == SpellingClass::builtinType)
                 return TokenAttributes::tyBuiltin;
             if (clang_isDeclaration(k) || k == CXCursor_DeclStmt)
                 return TokenAttributes::kwDecl;
-            if (sp == "sizeof" || sp == "alignof")
+            if (spCls == SpellingClass::opWord)
                 return TokenAttributes::opWord;
-            if (sp == "this")
+            if (spCls == SpellingClass::kwThis)
                 return TokenAttributes::litKw;
             return TokenAttributes::kw;
         }
 
-        case CXToken_Identifier:
-            if (isTypeCursorKind(k))
-                return TokenAttributes::ty;
-            if (isFunctionCursorKind(k))
-                return TokenAttributes::func;
-            SYNTH_DISCLANGWARN_BEGIN("-Wswitch-enum")
-            switch (k) {
-                case CXCursor_ObjCPropertyDecl:
-                    return TokenAttributes::varNonstaticMember; // Sorta right.
-
-                case CXCursor_ObjCIvarDecl:
-                case CXCursor_FieldDecl:
-                    return TokenAttributes::varNonstaticMember; // TODO
-
-                case CXCursor_EnumConstantDecl:
-                case CXCursor_NonTypeTemplateParameter:
-                    return TokenAttributes::constant;
-
-                case CXCursor_VarDecl:
-                    return getVarTokenAttributes(cur);
-                case CXCursor_ParmDecl:
-                    return TokenAttributes::varLocal;
-
-                case CXCursor_Namespace:
-                case CXCursor_NamespaceAlias:
-                case CXCursor_UsingDirective:
-                case CXCursor_NamespaceRef:
-                    return TokenAttributes::namesp;
-
-                case CXCursor_LabelStmt:
-                    return TokenAttributes::lbl;
-
-                default: {
-                    if (clang_isAttribute(k))
-                        return TokenAttributes::attr;
-                    CXCursor refd = clang_getCursorReferenced(cur);
-                    bool recErr = recursionDepth > kMaxRefRecursion;
-                    if (recErr) {
-                        CgStr kindSp(clang_getCursorKindSpelling(k));
-                        CgStr rKindSp(clang_getCursorKindSpelling(
-                                clang_getCursorKind(refd)));
-                        std::clog << "When trying to highlight token "
-                                << clang_getTokenExtent(tu, tok) << " "
-                                << sp << ":\n"
-                                << "  Cursor " << clang_getCursorExtent(cur)
-                                << " " << kindSp << " references "
-                                << clang_getCursorExtent(refd)
-                                << " " << rKindSp
-                                << "  Maximum depth exceeded with "
-                                << recursionDepth << ".\n";
-                        return TokenAttributes::none;
-                    }
-
-                    if (clang_equalCursors(cur, refd))
-                        return TokenAttributes::none;
-
-                    return getTokenAttributesImpl(
-                        tok, refd, sp, tu, recursionDepth + 1);
-                }
+        case CXToken_Identifier: {
+            TokenAttributes fixedAttrs = identifierKindAttrs(k);
+            if (fixedAttrs != TokenAttributes::none)
+                return fixedAttrs;
+            if (k == CXCursor_VarDecl)
+                return cache.varTokenAttributes(cur);
+            if (clang_isAttribute(k))
+                return TokenAttributes::attr;
+            CXCursor refd = clang_getCursorReferenced(cur);
+            bool recErr = recursionDepth > kMaxRefRecursion;
+            if (recErr) {
+                CgStr kindSp(clang_getCursorKindSpelling(k));
+                CgStr rKindSp(clang_getCursorKindSpelling(
+                        clang_getCursorKind(refd)));
+                std::clog << "When trying to highlight token "
+                        << sp << ":\n"
+                        << "  Cursor " << clang_getCursorExtent(cur)
+                        << " " << kindSp << " references "
+                        << clang_getCursorExtent(refd)
+                        << " " << rKindSp
+                        << "  Maximum depth exceeded with "
+                        << recursionDepth << ".\n";
+                return TokenAttributes::none;
             }
+
+            if (clang_equalCursors(cur, refd))
+                return TokenAttributes::none;
+
+            return getTokenAttributesImpl(
+                tk, refd, sp, cache, recursionDepth + 1);
+        }
     }
-    SYNTH_DISCLANGWARN_END
     assert("unreachable" && false);
     return TokenAttributes::none;
 }
 
 TokenAttributes synth::getTokenAttributes(
-    CXToken tok, CXCursor cur, boost::string_ref tokSpelling)
+    CXTokenKind tk,
+    CXCursor cur,
+    boost::string_ref tokSpelling,
+    CursorCache& cache)
 {
-    return getTokenAttributesImpl(
-        tok, cur, tokSpelling, clang_Cursor_getTranslationUnit(cur), 0);
+    return getTokenAttributesImpl(tk, cur, tokSpelling, cache, 0);
 }
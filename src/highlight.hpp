@@ -8,9 +8,35 @@
 
 namespace synth {
 
+class CursorCache;
+
+// Token spellings that need special treatment.
+enum class SpellingClass : unsigned char {
+    other,
+    builtinType, // "int", "unsigned", ...
+    opWord, // "sizeof", "alignof"
+    kwThis,
+    kwOperator,
+    ppInclude, // "#", "include"
+    openParen, // "(", "["
+    declPunct // "{", ";"
+};
+
+// Uses a perfect hash table; this is called for each token.
+SpellingClass classifySpelling(boost::string_ref sp);
+
 TokenAttributes getTokenAttributes(
-    CXToken tok, CXCursor cur, boost::string_ref tokSpelling);
+    CXTokenKind tk,
+    CXCursor cur,
+    boost::string_ref tokSpelling,
+    CursorCache& cache);
+
+// Highlighting for an integer literal spelled sp.
+TokenAttributes getIntTokenAttributes(boost::string_ref sp);
 
+// Highlighting for a token referring to the variable declared by cur.
+// Prefer CursorCache::varTokenAttributes().
+TokenAttributes getVarTokenAttributes(CXCursor cur);
 
 bool isTypeAliasCursorKind(CXCursorKind k);
 
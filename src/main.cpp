@@ -1,20 +1,31 @@
-#include "CgStr.hpp"
 #include "DoxytagResolver.hpp"
+#include "FileWatcher.hpp"
+#include "IncludeGraph.hpp"
+#include "Metrics.hpp"
 #include "MultiTuProcessor.hpp"
+#include "ProgressReporter.hpp"
 #include "SimpleTemplate.hpp"
+#include "Tracer.hpp"
 #include "annotate.hpp"
 #include "cgWrappers.hpp"
 #include "cmdline.hpp"
+#include "compileCommands.hpp"
+#include "forkedWorkers.hpp"
+#include "memstats.hpp"
 
 #include <boost/filesystem.hpp>
-#include <boost/io/ios_state.hpp>
 
 #include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
 
 using namespace synth;
 
@@ -45,9 +56,15 @@ struct InitialPathResetter {
     }
 };
 
+struct TuBudget {
+    unsigned timeoutSecs; // 0: Unlimited.
+    bool retryCheaper;
+};
+
 struct ThreadSharedState {
     CXIndex cidx;
     MultiTuProcessor& multiTuProcessor;
+    TuBudget budget;
     std::mutex workingDirMut;
     std::mutex outputMut;
     std::condition_variable workingDirChangedOrFree;
@@ -95,42 +112,73 @@ private:
 
 } // anonyomous namespace
 
-static std::vector<CgStr> getClArgs(CXCompileCommand cmd)
+// Returns the absolute path of cmd's main file, resolving a relative
+// directory against the initial working directory.
+static fs::path mainFilePath(CompileCommand const& cmd)
+{
+    return fs::absolute(
+        cmd.file, fs::absolute(cmd.directory, fs::initial_path()));
+}
+
+// Calls processTu(), retrying once with cheaper options if the time budget
+// was exceeded and budget.retryCheaper is set.
+static int processTuWithBudget(
+    CXIndex cidx,
+    MultiTuProcessor& multiTuProcessor,
+    char const* const* args,
+    int nargs,
+    TuBudget const& budget,
+    bool scanFirst = false)
 {
-    std::vector<CgStr> result;
-    unsigned nArgs = clang_CompileCommand_getNumArgs(cmd);
-    result.reserve(nArgs);
-    for (unsigned i = 0; i < nArgs; ++i)
-        result.push_back(clang_CompileCommand_getArg(cmd, i));
-    return result;
+    ProcessTuOptions opts;
+    opts.scanFirst = scanFirst;
+    if (budget.timeoutSecs != 0) {
+        opts.deadline = std::chrono::steady_clock::now()
+            + std::chrono::seconds(budget.timeoutSecs);
+    }
+    int r = processTu(cidx, multiTuProcessor, args, nargs, opts);
+    if (r != kTuTimedOut || !budget.retryCheaper)
+        return r;
+    std::clog << "Retrying with function bodies skipped.\n";
+    opts.deadline = std::chrono::steady_clock::now()
+        + std::chrono::seconds(budget.timeoutSecs);
+    opts.skipFunctionBodies = true;
+    opts.scanFirst = false;
+    return processTu(cidx, multiTuProcessor, args, nargs, opts);
 }
 
 static bool processCompileCommand(
-    CXCompileCommand cmd,
-    std::vector<char const*> extraArgs,
-    float pct,
+    CompileCommand const& cmd,
+    std::vector<char const*> const& extraArgs,
     ThreadSharedState& state)
 {
-    CgStr file(clang_CompileCommand_getFilename(cmd));
-    if (!file.empty() && !state.multiTuProcessor.isFileIncluded(file.get()))
+    Metrics* metrics = state.multiTuProcessor.metrics();
+    fs::path mainFile = mainFilePath(cmd);
+    if (!cmd.file.empty() && !state.multiTuProcessor.isFileIncluded(mainFile)) {
+        if (metrics)
+            ++metrics->tusSkipped;
         return false;
+    }
+    // E.g. another configuration of an already processed file (see
+    // orderCmdsByMainFile()), which often includes nothing new.
+    bool scanFirst = !cmd.file.empty()
+        && state.multiTuProcessor.isFileProcessed(mainFile);
 
-    std::vector<CgStr> clArgsHandles = getClArgs(cmd);
     std::vector<char const*> clArgs;
-    clArgs.reserve(clArgsHandles.size() + extraArgs.size());
-    for (CgStr const& s : clArgsHandles)
-        clArgs.push_back(s.get());
+    clArgs.reserve(cmd.args.size() + extraArgs.size());
+    for (std::string const& s : cmd.args)
+        clArgs.push_back(s.c_str());
     clArgs.insert(clArgs.end(), extraArgs.begin(), extraArgs.end());
-    CgStr dirStr = clang_CompileCommand_getDirectory(cmd);
     UIntRef dirRef(
         state.nWorkingDirUsers,
         state.workingDirChangedOrFree,
         state.workingDirMut);
 
     bool dirChanged = false;
-    if (!dirStr.empty()) {
-        fs::path dir = std::move(dirStr).gets();
+    if (!cmd.directory.empty()) {
+        fs::path dir = cmd.directory;
         bool dirOk;
+        auto waitBegin = Metrics::Clock::now();
         std::unique_lock<std::mutex> lock(state.workingDirMut);
         state.workingDirChangedOrFree.wait(lock, [&]() {
             if (state.cancel)
@@ -138,35 +186,43 @@ static bool processCompileCommand(
             dirOk = fs::current_path() == dir;
             return dirOk || state.nWorkingDirUsers == 0;
         });
-        if (state.cancel)
+        if (metrics) {
+            metrics->workingDirWaitNs += static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Metrics::Clock::now() - waitBegin).count());
+        }
+        if (state.cancel) {
+            if (metrics)
+                ++metrics->tusSkipped;
             return false;
+        }
         dirRef.acquire();
         if (!dirOk) {
             fs::current_path(dir);
             dirChanged = true;
         }
     } else {
-        std::lock_guard<std::mutex> lock(state.workingDirMut);
+        auto lock = lockCountingWait(
+            state.workingDirMut,
+            metrics ? &metrics->workingDirWaitNs : nullptr);
         dirRef.acquire();
     }
 
-    {
+    if (dirChanged) {
         std::lock_guard<std::mutex> lock(state.outputMut);
-
-        if (dirChanged)
-            std::clog << "Entered directory " << dirStr.get() << '\n';
-        boost::io::ios_all_saver saver(std::clog);
-        std::clog.flags(std::clog.flags() | std::ios::fixed);
-        std::clog.precision(2);
-        std::clog << '[' << std::setw(6) << pct << "%]: " << file << "...\n";
+        std::clog << "Entered directory " << cmd.directory << '\n';
     }
 
-
-    return processTu(
+    int r = processTuWithBudget(
         state.cidx,
         state.multiTuProcessor,
         clArgs.data(),
-        static_cast<int>(clArgs.size())) == EXIT_SUCCESS;
+        static_cast<int>(clArgs.size()),
+        state.budget,
+        scanFirst);
+    if (metrics)
+        metrics->countTuResult(r);
+    return r == EXIT_SUCCESS;
 }
 
 // Adapted from
@@ -180,6 +236,414 @@ static std::string getFileContents(char const* fname)
     return std::move(contents).str();
 }
 
+// Uses FNV-1a, so that files are assigned to the same shard everywhere.
+static bool isInShard(char const* fname, unsigned shardIdx, unsigned nShards)
+{
+    std::uint64_t h = 14695981039346656037u;
+    for (; *fname; ++fname) {
+        h ^= static_cast<unsigned char>(*fname);
+        h *= 1099511628211u;
+    }
+    return h % nShards == shardIdx;
+}
+
+static int writeIndexFile(MultiTuProcessor& state, char const* fname)
+{
+    std::ofstream indexFile(fname, std::ios::binary);
+    if (indexFile)
+        state.writeIndex(indexFile);
+    if (!indexFile.flush()) {
+        std::cerr << "Error writing index " << fname << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool loadIndexes(
+    MultiTuProcessor& state, std::vector<char const*> const& indexFnames)
+{
+    for (char const* indexFname : indexFnames) {
+        try {
+            if (!fs::is_regular_file(indexFname))
+                throw std::runtime_error("No such file.");
+            std::string index = getFileContents(indexFname);
+            state.loadIndex(index.data(), index.size());
+        } catch (std::exception const& e) {
+            std::cerr << "Error loading index " << indexFname << ": "
+                      << e.what() << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+// Merges the indexes and renders them or, if indexOutFname is not null,
+// writes the merged index there.
+static int renderIndexes(
+    std::vector<char const*> const& indexFnames,
+    char const* indexOutFname,
+    SimpleTemplate const& tpl)
+{
+    MultiTuProcessor state(PathMap(), [](Markup&, CXCursor) { });
+    IncludeGraph includeGraph;
+    if (indexOutFname)
+        state.setIncludeGraph(&includeGraph);
+    if (!loadIndexes(state, indexFnames))
+        return EXIT_FAILURE;
+    if (indexOutFname)
+        return writeIndexFile(state, indexOutFname);
+    state.writeOutput(tpl);
+    return EXIT_SUCCESS;
+}
+
+// Processes the commands cmds[cmdIndices[i]] on nThreads threads.
+static void processCmds(
+    std::vector<CompileCommand> const& cmds,
+    std::vector<unsigned> const& cmdIndices,
+    std::vector<char const*> const& extraArgs,
+    unsigned nThreads,
+    ThreadSharedState& tstate,
+    ProgressReporter& progress)
+{
+    auto const nCmds = static_cast<unsigned>(cmdIndices.size());
+    auto const processCmd = [&](unsigned cmdIdx, unsigned slot) {
+        progress.begin(slot, cmdIdx);
+        bool ok = processCompileCommand(cmds[cmdIdx], extraArgs, tstate);
+        progress.end(slot);
+        tstate.multiTuProcessor.writeFinishedFiles();
+        return ok;
+    };
+
+    // It seems [1] that during creation of the first translation,
+    // no others may be created or data races occur inside libclang.
+    // [1]: Detected by clang's TSan.
+    unsigned idx = 0;
+    while (idx < nCmds && !processCmd(cmdIndices[idx++], 0))
+        assert(tstate.nWorkingDirUsers == 0);
+
+    std::atomic_uint sharedCmdIdx(idx);
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    auto const cancel = [&tstate]() {
+        tstate.cancel = true; // Do before locking to reduce wait time.
+        {
+            std::lock_guard<std::mutex> lock(tstate.workingDirMut);
+            tstate.cancel = true; // Repeat for condition variable.
+        }
+        tstate.workingDirChangedOrFree.notify_all();
+    };
+    std::mutex errorMut;
+    std::exception_ptr error; // The first one of any worker.
+    auto const worker = [&](unsigned slot) {
+        try {
+            while (!tstate.cancel) {
+                unsigned pos = sharedCmdIdx++;
+                if (pos >= nCmds)
+                    return;
+                processCmd(cmdIndices[pos], slot);
+            }
+        } catch (...) {
+            cancel();
+            std::lock_guard<std::mutex> lock(errorMut);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+    try {
+        for (unsigned i = 1; i < nThreads; ++i)
+            threads.emplace_back(worker, i);
+        worker(0);
+    } catch (...) {
+        cancel();
+        for (auto& th : threads)
+            th.join();
+        assert(tstate.nWorkingDirUsers == 0);
+        throw;
+    }
+    for (auto& th : threads)
+        th.join();
+    assert(tstate.nWorkingDirUsers == 0);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Reads compile commands from in, one JSON object per line as in a
+// compile_commands.json, and processes them on nThreads threads as they
+// arrive, until the end of in. Malformed lines are reported and skipped.
+static void processCmdStream(
+    std::istream& in,
+    std::vector<char const*> const& extraArgs,
+    unsigned nThreads,
+    bool allConfigs,
+    ThreadSharedState& tstate)
+{
+    // A deque, so that workers can use commands while others are added.
+    std::deque<CompileCommand> cmds;
+    std::size_t nextCmd = 0;
+    bool inputDone = false;
+    bool firstTuDone = false; // See processCmds().
+    std::exception_ptr error;
+    std::mutex mut;
+    std::condition_variable cmdsChanged;
+    ProgressReporter progress(
+        0,
+        nThreads,
+        [&](unsigned cmdIdx) {
+            std::lock_guard<std::mutex> lock(mut);
+            return cmds[cmdIdx].file;
+        },
+        std::clog);
+
+    // Returns nullptr once all commands were taken.
+    auto const takeCmd = [&](
+        unsigned slot, unsigned& cmdIdx) -> CompileCommand const* {
+        std::unique_lock<std::mutex> lock(mut);
+        cmdsChanged.wait(lock, [&]() {
+            if (tstate.cancel || nextCmd == cmds.size())
+                return tstate.cancel || inputDone;
+            return slot == 0 || firstTuDone;
+        });
+        if (tstate.cancel || nextCmd == cmds.size())
+            return nullptr;
+        cmdIdx = static_cast<unsigned>(nextCmd);
+        return &cmds[nextCmd++];
+    };
+    auto const worker = [&](unsigned slot) {
+        try {
+            unsigned cmdIdx;
+            while (CompileCommand const* cmd = takeCmd(slot, cmdIdx)) {
+                progress.begin(slot, cmdIdx);
+                bool ok = processCompileCommand(*cmd, extraArgs, tstate);
+                progress.end(slot);
+                tstate.multiTuProcessor.writeFinishedFiles();
+                if (ok && slot == 0 && !firstTuDone) {
+                    {
+                        std::lock_guard<std::mutex> lock(mut);
+                        firstTuDone = true;
+                    }
+                    cmdsChanged.notify_all();
+                }
+            }
+        } catch (...) {
+            tstate.cancel = true;
+            {
+                std::lock_guard<std::mutex> lock(tstate.workingDirMut);
+                tstate.cancel = true; // Repeat for condition variable.
+            }
+            tstate.workingDirChangedOrFree.notify_all();
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                if (!error)
+                    error = std::current_exception();
+            }
+            cmdsChanged.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads);
+    for (unsigned i = 0; i < nThreads; ++i)
+        threads.emplace_back(worker, i);
+    Metrics* metrics = tstate.multiTuProcessor.metrics();
+    IncludeGraph::FileSet mainFiles; // See orderCmdsByMainFile().
+    std::string line;
+    for (unsigned lineno = 1; !tstate.cancel && std::getline(in, line);
+        ++lineno
+    ) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        CompileCommand cmd;
+        try {
+            cmd = parseCompileCommand(line.data(), line.data() + line.size());
+        } catch (std::runtime_error const& e) {
+            std::cerr << "Ignoring line " << lineno << ": " << e.what() << '\n';
+            continue;
+        }
+        if (metrics)
+            ++metrics->tusPlanned;
+        if (!allConfigs && !cmd.file.empty() && !mainFiles.insert(
+                IncludeGraph::normalize(mainFilePath(cmd))).second
+        ) {
+            if (metrics)
+                ++metrics->tusSkipped;
+            continue;
+        }
+        progress.addTus(1);
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            cmds.push_back(std::move(cmd));
+        }
+        cmdsChanged.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        inputDone = true;
+    }
+    cmdsChanged.notify_all();
+    for (auto& th : threads)
+        th.join();
+    assert(tstate.nWorkingDirUsers == 0);
+    progress.stop();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Returns the indices of cmds, leaving out the nSameMainFile commands for main
+// files that an earlier command already has (e.g. in another build
+// configuration), as only the first processing of a file is rendered. With
+// keepSameMainFile, these come last instead, for the declarations and headers
+// only their configuration sees.
+static std::vector<unsigned> orderCmdsByMainFile(
+    std::vector<CompileCommand> const& cmds,
+    bool keepSameMainFile,
+    unsigned& nSameMainFile)
+{
+    std::vector<unsigned> r, sameMainFile;
+    IncludeGraph::FileSet mainFiles;
+    for (unsigned i = 0; i < cmds.size(); ++i) {
+        if (cmds[i].file.empty() || mainFiles.insert(
+                IncludeGraph::normalize(mainFilePath(cmds[i]))).second
+        ) {
+            r.push_back(i);
+        } else {
+            sameMainFile.push_back(i);
+        }
+    }
+    nSameMainFile = static_cast<unsigned>(sameMainFile.size());
+    if (keepSameMainFile)
+        r.insert(r.end(), sameMainFile.begin(), sameMainFile.end());
+    return r;
+}
+
+using CmdsByFile = std::unordered_map<std::string, std::vector<unsigned>>;
+
+// Maps the main files of the commands cmds[cmdIndices[i]] (as normalized by
+// IncludeGraph::normalize()) to the commands.
+static CmdsByFile cmdsByMainFile(
+    std::vector<CompileCommand> const& cmds,
+    std::vector<unsigned> const& cmdIndices)
+{
+    CmdsByFile r;
+    for (unsigned cmdIdx : cmdIndices) {
+        r[IncludeGraph::normalize(mainFilePath(cmds[cmdIdx]))]
+            .push_back(cmdIdx);
+    }
+    return r;
+}
+
+// Resets the files of the translation units in cmdsByFile that include any of
+// the changed files and processes these translation units again. Returns false
+// if there were none.
+static bool reprocessChanged(
+    IncludeGraph::FileSet const& changed,
+    CmdsByFile const& cmdsByFile,
+    std::vector<CompileCommand> const& cmds,
+    CmdLineArgs const& args,
+    ThreadSharedState& tstate,
+    IncludeGraph const& includeGraph)
+{
+    MultiTuProcessor& state = tstate.multiTuProcessor;
+    IncludeGraph::FileSet mainFiles;
+    std::vector<unsigned> affected;
+    auto const addAffected = [&](IncludeGraph::FileSet const& files) {
+        for (std::string const& f : includeGraph.includersOf(files)) {
+            auto it = cmdsByFile.find(f);
+            if (it != cmdsByFile.end() && mainFiles.insert(f).second)
+                affected.insert(
+                    affected.end(), it->second.begin(), it->second.end());
+        }
+    };
+    addAffected(changed);
+    if (affected.empty())
+        return false;
+    std::clog << changed.size() << " file(s) changed, reprocessing "
+              << affected.size() << " translation unit(s).\n";
+    IncludeGraph::FileSet resetFiles = includeGraph.includedBy(mainFiles);
+    resetFiles.insert(changed.begin(), changed.end());
+    state.resetFiles(resetFiles);
+
+    // Not all reset files may be processed by these translation units again,
+    // e.g. if an #include was removed. Those are left to the translation
+    // units including them.
+    while (!affected.empty()) {
+        if (Metrics* metrics = state.metrics())
+            metrics->tusPlanned += static_cast<unsigned>(affected.size());
+        ProgressReporter progress(
+            static_cast<unsigned>(affected.size()),
+            args.nThreads,
+            [&cmds](unsigned cmdIdx) { return cmds[cmdIdx].file; },
+            std::clog);
+        processCmds(
+            cmds, affected, args.clangArgs, args.nThreads, tstate, progress);
+        progress.stop();
+        affected.clear();
+        addAffected(state.unprocessedResetFiles());
+    }
+    return true;
+}
+
+// Waits for changes of files below the input directories, reprocesses the
+// translation units that include them and rewrites the affected output files.
+// Runs until the process is killed or the file watcher fails.
+static void watchForChanges(
+    std::vector<CompileCommand> const& cmds,
+    std::vector<unsigned> const& cmdIndices,
+    CmdLineArgs const& args,
+    ThreadSharedState& tstate,
+    IncludeGraph const& includeGraph,
+    SimpleTemplate const& tpl)
+{
+    CmdsByFile cmdsByFile = cmdsByMainFile(cmds, cmdIndices);
+    std::vector<fs::path> dirs;
+    for (auto const& dir : args.inOutDirs)
+        dirs.push_back(fs::absolute(dir.first, fs::initial_path()));
+
+    FileWatcher watcher(dirs);
+    std::clog << "Watching for changes...\n";
+    for (;;) {
+        IncludeGraph::FileSet changed =
+            watcher.waitForChanges(std::chrono::milliseconds(200));
+        try {
+            {
+                InitialPathResetter pathResetter;
+                if (!reprocessChanged(
+                    changed, cmdsByFile, cmds, args, tstate, includeGraph)
+                ) {
+                    continue;
+                }
+            }
+            tstate.multiTuProcessor.writeOutput(tpl);
+        } catch (std::exception const& e) {
+            std::cerr << "Error updating output: " << e.what() << '\n';
+            tstate.cancel = false;
+        }
+        std::clog << "Watching for changes...\n";
+    }
+}
+
+// Reads one path per line from fname ("-" for stdin), relative paths being
+// relative to the current directory.
+static IncludeGraph::FileSet readChangedFiles(char const* fname)
+{
+    std::ifstream file;
+    if (std::strcmp(fname, "-") != 0) {
+        file.open(fname);
+        if (!file) {
+            throw std::runtime_error(
+                std::string("Error opening list of changed files ") + fname);
+        }
+    }
+    std::istream& in = file.is_open() ? file : std::cin;
+    IncludeGraph::FileSet r;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            r.insert(IncludeGraph::normalize(line));
+    }
+    return r;
+}
 
 static int executeCmdLine(CmdLineArgs const& args)
 {
@@ -194,13 +658,18 @@ static int executeCmdLine(CmdLineArgs const& args)
     } else {
         tpl = SimpleTemplate(kDefaultTemplateText); 
     }
+    if (!args.indexInFiles.empty() && !args.changedFilesList)
+        return renderIndexes(args.indexInFiles, args.indexOutFile, tpl);
 
+    std::vector<DoxytagResolver> doxyResolvers;
+    doxyResolvers.reserve(args.doxyTagFiles.size()); // Keep addresses stable.
     std::vector<ExternalRefLinker> refLinkers;
     for (auto const& doxyMapping : args.doxyTagFiles) {
+        doxyResolvers.push_back(DoxytagResolver::fromTagFilename(
+            doxyMapping.first,
+            doxyMapping.second));
         refLinkers.push_back(std::bind(&DoxytagResolver::link,
-            DoxytagResolver::fromTagFilename(
-                doxyMapping.first,
-                doxyMapping.second),
+            &doxyResolvers.back(),
             std::placeholders::_1, std::placeholders::_2));
     }
 
@@ -220,94 +689,229 @@ static int executeCmdLine(CmdLineArgs const& args)
             }
         });
     state.setMaxIdSz(args.maxIdSz);
+    if (args.maxMemoryMiB != 0) {
+        state.setMemoryLimit(
+            std::size_t(args.maxMemoryMiB) << 20, fs::temp_directory_path());
+    }
+    auto const printMemoryStats = [&](char const* heading) {
+        MemoryStats stats = {};
+        state.addMemoryStats(stats);
+        for (auto const& resolver : doxyResolvers)
+            resolver.addMemoryStats(stats);
+        stats.writeTo(std::clog, heading);
+    };
+
+    // Open the trace file now, before the working directory is changed.
+    std::unique_ptr<Tracer> tracer;
+    std::ofstream traceFile;
+    if (args.traceFile) {
+        traceFile.open(args.traceFile, std::ios::binary);
+        if (!traceFile) {
+            std::cerr << "Error opening trace file " << args.traceFile << '\n';
+            return EXIT_FAILURE;
+        }
+        tracer.reset(new Tracer());
+        state.setTracer(tracer.get());
+    }
 
+    Metrics metrics;
+    std::unique_ptr<MetricsFileWriter> metricsWriter;
+    if (args.metricsFile) {
+        if (!tracer) {
+            // Only needed for the per-phase times.
+            tracer.reset(new Tracer(/*keepEvents:*/ false));
+            state.setTracer(tracer.get());
+        }
+        state.setMetrics(&metrics);
+        metricsWriter.reset(
+            new MetricsFileWriter(args.metricsFile, metrics, tracer.get()));
+    }
+
+    std::unique_ptr<IncludeGraph> includeGraph;
+    if (args.watch || args.indexOutFile || args.changedFilesList) {
+        includeGraph.reset(new IncludeGraph());
+        state.setIncludeGraph(includeGraph.get());
+    }
+    IncludeGraph::FileSet changedFiles;
+    if (args.changedFilesList) {
+        if (!loadIndexes(state, args.indexInFiles))
+            return EXIT_FAILURE;
+        // The output of the unchanged files is expected to be there already.
+        state.markAllWritten();
+        changedFiles = readChangedFiles(args.changedFilesList);
+    }
+
+    ThreadSharedState tstate {
+        /*cidx=*/ hcidx.get(),
+        /*multiTuProcessor=*/ state,
+        /*budget=*/ {args.tuTimeout, args.tuTimeoutRetry},
+        /*workingDirMut=*/ {},
+        /*outputMut=*/ {},
+        /*workingDirChangedOrFree=*/ {},
+        /*nWorkingDirUsers=*/ 0u,
+        /*cancel=*/ {false}};
+    // Before any translation unit is processed.
+    auto const startProgressiveOutput = [&]() {
+        if (!args.progressive)
+            return;
+        std::clog << "Found " << state.addAllInputFiles()
+                  << " files to highlight lexically first.\n";
+        state.startProgressiveOutput(tpl);
+    };
+    std::vector<CompileCommand> cmds;
+    std::vector<unsigned> cmdIndices;
     if (args.compilationDbDir) {
-        CXCompilationDatabase_Error err;
-        CgDbHandle db(clang_CompilationDatabase_fromDirectory(
-                args.compilationDbDir, &err));
-        if (err != CXCompilationDatabase_NoError) {
-            std::cerr << "Failed loading compilation database (code "
-                      << static_cast<int>(err)
-                      << ")\n";
-            return err + 20;
+        // Commands of other shards or for files outside the input directories
+        // are dropped while loading, before their arguments are even parsed.
+        unsigned nOtherShards = 0;
+        auto const keepCmd = [&](CompileCommand const& cmd) {
+            if (args.nShards != 0 && !isInShard(
+                    cmd.file.c_str(), args.shardIdx, args.nShards)
+            ) {
+                ++nOtherShards;
+                return false;
+            }
+            return cmd.file.empty() || state.isFileIncluded(mainFilePath(cmd));
+        };
+        LoadedCompileCommands db;
+        try {
+            db = loadCompileCommands(
+                fs::path(args.compilationDbDir) / "compile_commands.json",
+                keepCmd);
+        } catch (std::exception const& e) {
+            std::cerr << "Failed loading compilation database: " << e.what()
+                      << '\n';
+            return CXCompilationDatabase_CanNotLoadDatabase + 20;
         }
-        CgCmdsHandle cmds(
-            clang_CompilationDatabase_getAllCompileCommands(db.get()));
-        unsigned nCmds = clang_CompileCommands_getSize(cmds.get());
-        if (nCmds == 0) {
+        if (db.nEntries == 0) {
             std::cerr << "No compilation commands in DB.\n";
             return EXIT_SUCCESS;
         }
-
-        InitialPathResetter pathResetter;
-        ThreadSharedState tstate {
-            /*cidx=*/ hcidx.get(),
-            /*multiTuProcessor=*/ state,
-            /*workingDirMut=*/ {},
-            /*outputMut=*/ {},
-            /*workingDirChangedOrFree=*/ {},
-            /*nWorkingDirUsers=*/ 0u,
-            /*cancel=*/ {false}};
-
-        // It seems [1] that during creation of the first translation,
-        // no others may be created or data races occur inside libclang.
-        // [1]: Detected by clang's TSan.
-        unsigned idx = 0;
-        while (!processCompileCommand(
-            clang_CompileCommands_getCommand(cmds.get(), idx++),
-            args.clangArgs,
-            0,
-            tstate)
-        ) {
-            assert(tstate.nWorkingDirUsers == 0);
+        cmds = std::move(db.cmds);
+        unsigned nSameMainFile;
+        cmdIndices = orderCmdsByMainFile(cmds, args.allConfigs, nSameMainFile);
+        auto const nCmds = static_cast<unsigned>(cmdIndices.size());
+        unsigned const nInShard = db.nEntries - nOtherShards;
+        if (!args.changedFilesList) {
+            metrics.tusPlanned = nInShard;
+            metrics.tusSkipped += nInShard - nCmds;
         }
-
-        std::atomic_uint sharedCmdIdx(idx);
-        std::vector<std::thread> threads;
-        threads.reserve(args.nThreads - 1);
-        std::clog << "Using " << args.nThreads << " threads.\n";
-        auto const worker = [&]() {
-            while (!tstate.cancel) {
-                unsigned cmdIdx = sharedCmdIdx++;
-                if (cmdIdx >= nCmds)
-                    return;
-
-                processCompileCommand(
-                    clang_CompileCommands_getCommand(cmds.get(), cmdIdx),
+        if (args.nShards != 0) {
+            std::clog << "Shard " << args.shardIdx << '/' << args.nShards
+                      << ": " << nInShard << " of " << db.nEntries
+                      << " commands.\n";
+        }
+        std::clog << "Using " << nCmds << " of " << nInShard
+                  << " commands (" << db.nFiltered - nOtherShards
+                  << " outside the input directories, " << db.nDuplicates
+                  << " duplicates, " << nSameMainFile
+                  << (args.allConfigs ? " processed last" : " skipped")
+                  << " for already seen main files).\n";
+
+        startProgressiveOutput();
+        InitialPathResetter pathResetter;
+        if (args.changedFilesList) {
+            if (!reprocessChanged(
+                changedFiles,
+                cmdsByMainFile(cmds, cmdIndices),
+                cmds,
+                args,
+                tstate,
+                *includeGraph)
+            ) {
+                std::clog << "No translation unit includes a changed file.\n";
+            }
+        } else {
+            ProgressReporter progress(
+                nCmds,
+                args.nThreads,
+                [&cmds](unsigned cmdIdx) { return cmds[cmdIdx].file; },
+                std::clog);
+            if (args.forkWorkers) {
+                std::clog << "Using " << args.nThreads
+                          << " worker processes.\n";
+                processInWorkerProcesses(
+                    cmds,
+                    cmdIndices,
+                    args.clangArgs,
+                    state,
+                    {args.nThreads, args.tuTimeout, args.tuTimeoutRetry},
+                    progress);
+            } else {
+                std::clog << "Using " << args.nThreads << " threads.\n";
+                processCmds(
+                    cmds,
+                    cmdIndices,
                     args.clangArgs,
-                    static_cast<float>(cmdIdx) / nCmds * 100,
-                    tstate);
+                    args.nThreads,
+                    tstate,
+                    progress);
             }
-        };
-        try {
-            for (unsigned i = 0; i < args.nThreads - 1; ++i)
-                threads.emplace_back(worker);
-            worker();
-        } catch (...) {
-            tstate.cancel = true; // Do before locking to reduce wait time.
-            {
-                std::lock_guard<std::mutex> lock(tstate.workingDirMut);
-                tstate.cancel = true; // Repeat for condition variable.
+            progress.stop();
+        }
+    } else if (args.cmdStreamFile) {
+        std::ifstream cmdFile;
+        if (std::strcmp(args.cmdStreamFile, "-") != 0) {
+            cmdFile.open(args.cmdStreamFile);
+            if (!cmdFile) {
+                std::cerr << "Error opening " << args.cmdStreamFile << '\n';
+                return EXIT_FAILURE;
             }
-            tstate.workingDirChangedOrFree.notify_all();
-            for (auto& th : threads)
-                th.join();
-            assert(tstate.nWorkingDirUsers == 0);
-            throw;
         }
-        for (auto& th : threads)
-            th.join();
-        assert(tstate.nWorkingDirUsers == 0);
+        startProgressiveOutput();
+        InitialPathResetter pathResetter;
+        std::clog << "Using " << args.nThreads << " threads.\n";
+        processCmdStream(
+            cmdFile.is_open() ? cmdFile : std::cin,
+            args.clangArgs,
+            args.nThreads,
+            args.allConfigs,
+            tstate);
+    } else if (args.lexicalOnly) {
+        std::clog << "Found " << state.addAllInputFiles()
+                  << " files to highlight lexically.\n";
     } else {
-        int r = synth::processTu(
+        metrics.tusPlanned = 1;
+        int r = processTuWithBudget(
             hcidx.get(),
             state,
             args.clangArgs.data(),
-            args.nClangArgs);
+            args.nClangArgs,
+            {args.tuTimeout, args.tuTimeoutRetry});
+        metrics.countTuResult(r);
         if (r)
             return r;
     }
-    state.writeOutput(tpl);
+    if (args.printStats) {
+        if (state.cursorCacheLookups() != 0) {
+            std::clog << "Cursor cache: " << state.cursorCacheHits() << " of "
+                      << state.cursorCacheLookups() << " lookups were hits.\n";
+        }
+        printMemoryStats("after parsing");
+    }
+    if (args.indexOutFile) {
+        if (int r = writeIndexFile(state, args.indexOutFile))
+            return r;
+    } else {
+        state.writeOutput(tpl);
+    }
+    if (args.printStats)
+        printMemoryStats("after output");
+    if (args.traceFile) {
+        tracer->writeTo(traceFile);
+        if (!traceFile.flush()) {
+            std::cerr << "Error writing trace file " << args.traceFile << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    if (metricsWriter)
+        metricsWriter->stop();
+    if (args.watch) {
+        // Both were written out above already.
+        state.setTracer(nullptr);
+        state.setMetrics(nullptr);
+        watchForChanges(cmds, cmdIndices, args, tstate, *includeGraph, tpl);
+    }
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,58 @@
+#include "memstats.hpp"
+
+#include <boost/io/ios_state.hpp>
+
+#include <iomanip>
+#include <ostream>
+
+#ifndef _WIN32
+#  include <sys/resource.h>
+#endif
+
+using namespace synth;
+
+static void writeItem(
+    std::ostream& out, char const* name, MemoryStats::Item const& item)
+{
+    out << "  " << std::left << std::setw(18) << name
+        << std::right << std::setw(12) << item.count
+        << std::setw(14) << item.bytes << " B\n";
+}
+
+void MemoryStats::writeTo(std::ostream& out, char const* heading) const
+{
+    boost::io::ios_all_saver saver(out);
+    out << "Memory usage " << heading << ":\n";
+    out << "  " << std::left << std::setw(18) << "" << std::right
+        << std::setw(12) << "count" << std::setw(16) << "approx. size\n";
+    writeItem(out, "Processed files", files);
+    writeItem(out, "Markups", markups);
+    writeItem(out, "CodeRef closures", codeRefs);
+    writeItem(out, "Symbols", symbols);
+    writeItem(out, "Definitions", defs);
+    writeItem(out, "fileUniqueNames", fileUniqueNames);
+    writeItem(out, "Doxytags", doxytags);
+    std::size_t total = files.bytes + markups.bytes + codeRefs.bytes
+        + symbols.bytes + defs.bytes + fileUniqueNames.bytes + doxytags.bytes;
+    out << "  " << std::left << std::setw(30) << "Total"
+        << std::right << std::setw(14) << total << " B\n";
+    std::size_t rss = peakRssBytes();
+    if (rss != 0)
+        out << "  Peak RSS: " << rss / 1024 << " KiB\n";
+}
+
+std::size_t synth::peakRssBytes()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#  ifdef __APPLE__
+    return static_cast<std::size_t>(usage.ru_maxrss); // Already in bytes.
+#  else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#  endif
+#endif
+}
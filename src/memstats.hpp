@@ -0,0 +1,57 @@
+#ifndef SYNTH_MEMSTATS_HPP_INCLUDED
+#define SYNTH_MEMSTATS_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+namespace synth {
+
+// Approximate memory usage of synth's long-lived data structures, as printed
+// by --stats. Byte counts include the element storage of containers and the
+// heap buffers of strings, but not allocator overhead.
+struct MemoryStats {
+    struct Item {
+        std::size_t count;
+        std::size_t bytes;
+    };
+
+    Item files;
+    Item markups;
+    Item codeRefs; // Only the heap part: the rest is counted in markups.
+    Item symbols;
+    Item defs;
+    Item fileUniqueNames;
+    Item doxytags;
+
+    void writeTo(std::ostream& out, char const* heading) const;
+};
+
+// Returns 0 if the peak resident set size cannot be determined.
+std::size_t peakRssBytes();
+
+// Size of the buffer s has allocated on the heap, 0 if it uses the small
+// string optimization.
+inline std::size_t stringHeapBytes(std::string const& s)
+{
+    char const* obj = reinterpret_cast<char const*>(&s);
+    std::less<char const*> lt;
+    if (!lt(s.data(), obj) && lt(s.data(), obj + sizeof(s)))
+        return 0;
+    return s.capacity() + 1;
+}
+
+// Approximation that assumes a node-based implementation (as all standard
+// libraries use) that stores the hash in each node.
+template <typename UnorderedMap>
+std::size_t unorderedMapBytes(UnorderedMap const& m)
+{
+    using Value = typename UnorderedMap::value_type;
+    return m.bucket_count() * sizeof(void*)
+        + m.size() * (sizeof(void*) + sizeof(Value) + sizeof(std::size_t));
+}
+
+} // namespace synth
+
+#endif // SYNTH_MEMSTATS_HPP_INCLUDED
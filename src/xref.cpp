@@ -1,11 +1,13 @@
 #include "xref.hpp"
 
 #include "CgStr.hpp"
+#include "CursorCache.hpp"
 #include "MultiTuProcessor.hpp"
 #include "config.hpp"
 #include "debug.hpp"
 #include "output.hpp"
 #include "highlight.hpp"
+#include "memstats.hpp"
 
 #include <boost/filesystem/path.hpp>
 
@@ -47,13 +49,8 @@ static std::pair<bool, CXCursor> typeAliasRedeclares(CXCursor decl)
     return {aliasQName == canonQName, canonDecl};
 }
 
-// Returns clang_getCursorReferenced(cur), unless the referenced cursor is a
-// type alias or typedef used in an occurence of the "typedef struct S { } S;"
-// pattern. In this case, it returns the declaration cursor of the struct
-// instead of the type alias.
-static CXCursor effectiveReferencedCursor(CXCursor cur)
+CXCursor synth::effectiveDeclaration(CXCursor refd)
 {
-    CXCursor refd = clang_getCursorReferenced(cur);
     CXCursorKind k = clang_getCursorKind(refd);
     if (k != CXCursor_TypedefDecl && k != CXCursor_TypeAliasDecl)
         return refd;
@@ -91,22 +88,34 @@ static std::string locationUrl(
     return r;
 }
 
+std::string SymbolRef::operator() (
+    fs::path const& outPath, MultiTuProcessor&) const
+{
+    return locationUrl(outPath, *sym);
+}
+
+std::string ExternalDefRef::operator() (
+    fs::path const& outPath, MultiTuProcessor& state) const
+{
+    SymbolDeclaration const* sym = state.findMissingDef(usr);
+    if (sym)
+        return locationUrl(outPath, *sym);
+    if (extRef)
+        return extRef(outPath, state);
+    return std::string();
+}
+
 static void linkSymbol(Markup& m, SymbolDeclaration const* sym)
 {
     if (!sym)
         return;
-    m.refd = [sym](fs::path const& outPath, MultiTuProcessor&) {
-        return locationUrl(outPath, *sym);
-    };
+    m.refd = SymbolRef {sym};
 }
 
-static void linkDeclCursor(Markup& m, CXCursor decl, MultiTuProcessor& state)
+static void linkDeclCursor(
+    Markup& m, CXCursor decl, MultiTuProcessor& state, CursorCache& cache)
 {
-    CXFile file;
-    unsigned lineno, offset;
-    clang_getFileLocation(
-        clang_getCursorLocation(decl), &file, &lineno, nullptr, &offset);
-    linkSymbol(m, state.referenceSymbol(file, lineno, offset));
+    linkSymbol(m, cache.declSymbol(decl, state));
 }
 
 static void linkInclude(Markup& m, CXCursor incCursor, MultiTuProcessor& state)
@@ -115,25 +124,18 @@ static void linkInclude(Markup& m, CXCursor incCursor, MultiTuProcessor& state)
     linkSymbol(m, state.referenceSymbol(file, 0, UINT_MAX));
 }
 
-static void linkExternalDef(Markup& m, CXCursor cur, MultiTuProcessor& state)
+static void linkExternalDef(
+    Markup& m, CXCursor cur, MultiTuProcessor& state, CursorCache& cache)
 {
-    CgStr hUsr(clang_getCursorUSR(cur));
-    if (hUsr.empty())
+    std::string const& usr = cache.usr(cur);
+    if (usr.empty())
         return;
     state.linkExternalRef(m, cur);
-    m.refd = [usr = hUsr.copy(), extRef = std::move(m.refd)] (
-        fs::path const& outPath, MultiTuProcessor& state_)
-    {
-        SymbolDeclaration const* sym = state_.findMissingDef(usr);
-        if (sym)
-            return locationUrl(outPath, *sym);
-        if (extRef)
-            return extRef(outPath, state_);
-        return std::string();
-    };
+    m.refd = ExternalDefRef {usr, std::move(m.refd)};
 }
 
-void synth::linkCursor(Markup& m, CXCursor cur, MultiTuProcessor& state)
+void synth::linkCursor(
+    Markup& m, CXCursor cur, MultiTuProcessor& state, CursorCache& cache)
 {
     CXCursorKind k = clang_getCursorKind(cur);
     bool shouldRef = false;
@@ -142,19 +144,18 @@ void synth::linkCursor(Markup& m, CXCursor cur, MultiTuProcessor& state)
         linkInclude(m, cur, state);
         shouldRef = true;
     } else {
-        CXCursor referenced = effectiveReferencedCursor(cur);
+        CXCursor referenced = cache.effectiveReferenced(cur);
         bool isref = !clang_Cursor_isNull(referenced)
             && !clang_equalCursors(cur, referenced);
         shouldRef = isref;
         if (isref) {
-            CgStr sp = clang_getCursorSpelling(referenced);
-            linkDeclCursor(m, referenced, state);
+            linkDeclCursor(m, referenced, state, cache);
         } else if (
             (m.attrs & (TokenAttributes::flagDef | TokenAttributes::flagDecl))
             != TokenAttributes::none
         ) {
             if ((m.attrs & TokenAttributes::flagDef) == TokenAttributes::none)
-                linkExternalDef(m, cur, state);
+                linkExternalDef(m, cur, state, cache);
             shouldRef = true;
         }
     }
@@ -164,14 +165,28 @@ void synth::linkCursor(Markup& m, CXCursor cur, MultiTuProcessor& state)
     state.linkExternalRef(m, std::move(cur));
     if (m.isRef())
         return;
-    CXCursor specialized = clang_getSpecializedCursorTemplate(cur);
+    CXCursor specialized = cache.specializedTemplate(cur);
     if (!clang_Cursor_isNull(specialized)
         && !clang_equalCursors(cur, specialized)
     ) {
-        linkDeclCursor(m, specialized, state);
+        linkDeclCursor(m, specialized, state, cache);
     }
 }
 
+std::size_t synth::codeRefHeapBytes(CodeRef const& ref)
+{
+    // The other closures only capture one or two pointers and are thus
+    // stored inside the std::function by all common implementations.
+    if (auto url = ref.target<UrlRef>())
+        return sizeof(UrlRef) + stringHeapBytes(url->url);
+    auto extDef = ref.target<ExternalDefRef>();
+    if (!extDef)
+        return 0;
+    return sizeof(ExternalDefRef)
+        + stringHeapBytes(extDef->usr)
+        + codeRefHeapBytes(extDef->extRef);
+}
+
 std::string synth::fileUniqueName(CXCursor cur, bool isC)
 {
     if (!isNamespaceLevelDeclaration(cur))
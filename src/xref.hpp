@@ -1,6 +1,8 @@
 #ifndef SYNTH_XREF_HPP_INCLUDED
 #define SYNTH_XREF_HPP_INCLUDED
 
+#include "output.hpp"
+
 #include <clang-c/Index.h>
 #include <string>
 
@@ -8,13 +10,55 @@ namespace synth {
 
 struct Markup;
 class MultiTuProcessor;
+class CursorCache;
 
-void linkCursor(Markup& m, CXCursor mcur, MultiTuProcessor& state);
+void linkCursor(
+    Markup& m, CXCursor mcur, MultiTuProcessor& state, CursorCache& cache);
 std::string fileUniqueName(CXCursor cur, bool isC);
 std::string simpleQualifiedName(CXCursor cur);
 
 bool isNamespaceLevelDeclaration(CXCursor cur);
 
+// Returns refd, unless it is a type alias or typedef used in an occurence of
+// the "typedef struct S { } S;" pattern. In this case, it returns the
+// declaration cursor of the struct instead of the type alias.
+CXCursor effectiveDeclaration(CXCursor refd);
+
+// The closures that linkCursor() stores in Markup::refd, as named types so
+// that they can be inspected (see codeRefHeapBytes() and
+// MultiTuProcessor::writeRecordedResult()).
+
+// Links to sym, which may be in another file.
+struct SymbolRef {
+    SymbolDeclaration const* sym;
+
+    std::string operator() (fs::path const& outPath, MultiTuProcessor&) const;
+};
+
+// Links to the definition of usr if any translation unit registered one and to
+// extRef (if set) otherwise.
+struct ExternalDefRef {
+    std::string usr;
+    CodeRef extRef;
+
+    std::string operator() (
+        fs::path const& outPath, MultiTuProcessor& state) const;
+};
+
+// Links to an URL that was already computed, e.g. by another process.
+struct UrlRef {
+    std::string url;
+
+    std::string operator() (fs::path const&, MultiTuProcessor&) const
+    {
+        return url;
+    }
+};
+
+// Approximate heap memory owned by the closure stored in ref (in addition to
+// sizeof(CodeRef)).
+std::size_t codeRefHeapBytes(CodeRef const& ref);
+
 } // namespace synth
 
 #endif // SYNTH_XREF_HPP_INCLUDED